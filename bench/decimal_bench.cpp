@@ -0,0 +1,194 @@
+/// Benchmark of the decimal conversion of Int, i.e. of to_string() and of
+/// parsing decimal strings.
+///
+/// Before timing, both are checked against the reference implementation:
+/// Edge cases first (0, Int::max(), leading zeros, values that do not fit in
+/// 256 bits and strings with characters other than digits), then round trips
+/// of random values of mixed widths and random digit strings of all lengths,
+/// so that every alignment to the chunks of the conversion is covered.
+/// With --check, only the check runs.
+
+#include "exceptions.h"
+#include "reference.h"
+#include "types.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <random>
+#include <vector>
+
+using namespace std;
+
+size_t errors = 0;
+
+void checkParse(string const& _digits, Int const& _expected)
+{
+	Int value;
+	try
+	{
+		value = Int(_digits);
+	}
+	catch (Exception const&)
+	{
+		printf("Int(\"%s\") throws, expected %s\n", _digits.c_str(), to_string(_expected).c_str());
+		errors++;
+		return;
+	}
+	if (value != _expected)
+	{
+		printf("Int(\"%s\") = %s, expected %s\n", _digits.c_str(), to_string(value).c_str(), to_string(_expected).c_str());
+		errors++;
+	}
+}
+
+void checkToString(Int const& _value)
+{
+	string expected = referenceToString(_value);
+	string text = to_string(_value);
+	if (text != expected)
+	{
+		printf("to_string(%s) = %s\n", expected.c_str(), text.c_str());
+		errors++;
+	}
+	checkParse(text, _value);
+}
+
+void checkRejected(string const& _text)
+{
+	try
+	{
+		Int value(_text);
+		printf("Int(\"%s\") = %s, expected to throw\n", _text.c_str(), to_string(value).c_str());
+		errors++;
+	}
+	catch (Exception const&)
+	{
+	}
+}
+
+string randomDigits(mt19937_64& _random, size_t _length)
+{
+	string digits(_length, '0');
+	for (char& digit: digits)
+		digit = char('0' + _random() % 10);
+	return digits;
+}
+
+/// @returns a random value with a random number of significant bits.
+Int randomValue(mt19937_64& _random)
+{
+	Int value;
+	for (uint64_t& word: value.data)
+		word = _random();
+	size_t bits = _random() % 257;
+	for (size_t i = 0; i < 4; i++)
+		if (bits <= 64 * i)
+			value.data[i] = 0;
+		else if (bits < 64 * (i + 1))
+			value.data[i] &= (uint64_t(1) << (bits - 64 * i)) - 1;
+	return value;
+}
+
+void checkConversion(mt19937_64& _random)
+{
+	string const max = "115792089237316195423570985008687907853269984665640564039457584007913129639935";
+	checkToString(Int(0));
+	checkToString(Int::max());
+	checkParse(max, Int::max());
+	checkParse("0", Int(0));
+	for (size_t digits = 1; digits <= 78; digits++)
+	{
+		// Powers of ten and the numbers just below them end and start chunks.
+		string power = "1" + string(digits - 1, '0');
+		checkToString(referenceFromString(power));
+		checkToString(referenceSubtract(referenceFromString(power), Int(1)));
+		checkParse(string(digits, '0'), Int(0));
+		checkParse(string(digits, '0') + "42", Int(42));
+		checkParse(string(digits, '0') + max, Int::max());
+	}
+
+	// Values that do not fit wrap around.
+	checkParse("115792089237316195423570985008687907853269984665640564039457584007913129639936", Int(0));
+	checkParse("115792089237316195423570985008687907853269984665640564039457584007913129639941", Int(5));
+	for (size_t length = 79; length <= 120; length++)
+	{
+		string digits = randomDigits(_random, length);
+		checkParse(digits, referenceFromString(digits));
+	}
+
+	// require() reports every rejection on cerr.
+	cerr.setstate(ios::failbit);
+	for (char const* text: {"-1", "+1", " 1", "1 ", "1.0", "1e3", "12a4"})
+		checkRejected(text);
+	for (size_t length = 1; length <= 80; length++)
+		for (char invalid: {'/', ':', 'a', ' '})
+		{
+			// The invalid character at every position of the chunks.
+			string text = randomDigits(_random, length);
+			text[_random() % length] = invalid;
+			if (text.substr(0, 2) != "0x")
+				checkRejected(text);
+		}
+	cerr.clear();
+
+	for (size_t i = 0; i < 20000; i++)
+	{
+		checkToString(randomValue(_random));
+		string digits = randomDigits(_random, 1 + _random() % 78);
+		checkParse(digits, referenceFromString(digits));
+	}
+}
+
+/// Runs @a _operation over all values and prints the time per call.
+template <class Operation>
+void measure(char const* _name, size_t _count, Operation _operation)
+{
+	size_t const rounds = 100;
+	size_t total = 0;
+	auto start = chrono::steady_clock::now();
+	for (size_t round = 0; round < rounds; round++)
+		for (size_t i = 0; i < _count; i++)
+			total += _operation(i);
+	double nanoseconds = chrono::duration<double, nano>(chrono::steady_clock::now() - start).count();
+	// Printing the result keeps the compiler from dropping the computation.
+	printf("%-22s %8.2f ns  (%zu)\n", _name, nanoseconds / double(rounds * _count), total);
+}
+
+int main(int argc, char const** argv)
+{
+	bool checkOnly = argc > 1 && strcmp(argv[1], "--check") == 0;
+
+	mt19937_64 random(42);
+	checkConversion(random);
+	if (errors)
+	{
+		printf("%zu conversions differ from the reference.\n", errors);
+		return 1;
+	}
+	printf("All conversions match the reference.\n");
+	if (checkOnly)
+		return 0;
+
+	// Token amounts are mostly in wei, i.e. around 18 to 24 digits.
+	vector<Int> amounts;
+	vector<Int> values;
+	for (size_t i = 0; i < 4096; i++)
+	{
+		amounts.push_back(referenceFromString(randomDigits(random, 18 + random() % 7)));
+		values.push_back(randomValue(random));
+	}
+	vector<string> amountTexts;
+	vector<string> valueTexts;
+	for (size_t i = 0; i < amounts.size(); i++)
+	{
+		amountTexts.push_back(referenceToString(amounts[i]));
+		valueTexts.push_back(referenceToString(values[i]));
+	}
+	measure("to_string (amounts)", amounts.size(), [&](size_t i) { return to_string(amounts[i]).size(); });
+	measure("to_string (any width)", values.size(), [&](size_t i) { return to_string(values[i]).size(); });
+	measure("parse (amounts)", amountTexts.size(), [&](size_t i) { return size_t(Int(amountTexts[i]).data[0]); });
+	measure("parse (any width)", valueTexts.size(), [&](size_t i) { return size_t(Int(valueTexts[i]).data[0]); });
+	return 0;
+}
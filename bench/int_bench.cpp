@@ -0,0 +1,124 @@
+/// Benchmark of the 256 bit arithmetic of Int.
+///
+/// Before timing, the operators are checked against a plain reference
+/// implementation on 32 bit digits, over values of mixed widths and the
+/// edge cases of the carries. With --check, only the check runs.
+
+#include "reference.h"
+#include "types.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <vector>
+
+using namespace std;
+
+/// @returns values with one to four significant words and the ones at the word boundaries.
+vector<Int> testValues(mt19937_64& _random, size_t _count)
+{
+	vector<Int> values{Int(0), Int(1), Int(uint64_t(-1)), Int::max(), Int::max() - Int(1)};
+	for (size_t word = 1; word < 4; word++)
+	{
+		Int x;
+		x.data[word] = 1;
+		values.push_back(x);
+		values.push_back(x - Int(1));
+	}
+	while (values.size() < _count)
+	{
+		Int x;
+		size_t words = 1 + _random() % 4;
+		for (size_t i = 0; i < words; i++)
+			x.data[i] = _random();
+		// Runs of ones make the carries go through several words.
+		if (_random() % 4 == 0)
+			x.data[_random() % words] = uint64_t(-1);
+		values.push_back(x);
+	}
+	return values;
+}
+
+/// @returns factors and divisors including the extremes of 32 bits.
+vector<uint32_t> testFactors(mt19937_64& _random, size_t _count)
+{
+	vector<uint32_t> factors{1, 2, 3, 10, 100, 0xffff, 0x10000, 0x7fffffff, 0x80000000, 0xffffffff};
+	while (factors.size() < _count)
+		factors.push_back(uint32_t(_random()) | 1);
+	return factors;
+}
+
+bool check(char const* _operation, Int const& _a, Int const& _result, Int const& _expected)
+{
+	if (_result == _expected)
+		return true;
+	printf("%s(%s) = %s, expected %s\n", _operation, to_string(_a).c_str(), to_string(_result).c_str(), to_string(_expected).c_str());
+	return false;
+}
+
+/// @returns the number of results that differ from the reference.
+size_t checkOperators(vector<Int> const& _values, vector<uint32_t> const& _factors)
+{
+	size_t errors = 0;
+	for (Int const& a: _values)
+	{
+		for (Int const& b: _values)
+		{
+			errors += !check("add", a, a + b, referenceAdd(a, b));
+			errors += !check("subtract", a, a - b, referenceSubtract(a, b));
+			Int x = a;
+			x += b;
+			x -= b;
+			errors += !check("add and subtract", a, x, a);
+		}
+		errors += !check("negate", a, -a, referenceSubtract(Int(0), a));
+		for (uint32_t factor: _factors)
+		{
+			errors += !check("multiply", a, a * factor, referenceMultiply(a, factor));
+			errors += !check("divide", a, a / factor, referenceDivide(a, factor));
+		}
+	}
+	return errors;
+}
+
+/// Runs @a _operation over all values and prints the time per call.
+template <class Operation>
+void measure(char const* _name, vector<Int> const& _values, Operation _operation)
+{
+	size_t const rounds = 1000;
+	Int accumulator;
+	auto start = chrono::steady_clock::now();
+	for (size_t round = 0; round < rounds; round++)
+		for (size_t i = 0; i < _values.size(); i++)
+			_operation(accumulator, _values[i], uint32_t(i | 1));
+	double nanoseconds = chrono::duration<double, nano>(chrono::steady_clock::now() - start).count();
+	// Printing the result keeps the compiler from dropping the computation.
+	printf("%-12s %8.2f ns  (%s)\n", _name, nanoseconds / double(rounds * _values.size()), to_string(accumulator).substr(0, 8).c_str());
+}
+
+int main(int argc, char const** argv)
+{
+	bool checkOnly = argc > 1 && strcmp(argv[1], "--check") == 0;
+
+	mt19937_64 random(42);
+	vector<Int> values = testValues(random, 300);
+	vector<uint32_t> factors = testFactors(random, 100);
+	if (size_t errors = checkOperators(values, factors))
+	{
+		printf("%zu results differ from the reference.\n", errors);
+		return 1;
+	}
+	printf("All results match the reference.\n");
+	if (checkOnly)
+		return 0;
+
+	values = testValues(random, 4096);
+	measure("add", values, [](Int& _x, Int const& _value, uint32_t) { _x += _value; });
+	measure("subtract", values, [](Int& _x, Int const& _value, uint32_t) { _x -= _value; });
+	measure("negate", values, [](Int& _x, Int const& _value, uint32_t) { _x += -_value; });
+	measure("multiply", values, [](Int& _x, Int const& _value, uint32_t _factor) { _x += _value * _factor; });
+	measure("divide", values, [](Int& _x, Int const& _value, uint32_t _divisor) { _x += _value / _divisor; });
+	measure("percentage", values, [](Int& _x, Int const& _value, uint32_t _factor) { _x += _value * (_factor % 101) / 100; });
+	return 0;
+}
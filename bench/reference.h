@@ -0,0 +1,109 @@
+#pragma once
+
+/// Plain reference implementations of the arithmetic of Int, which the
+/// benchmarks check the optimized operators against.
+
+#include "types.h"
+
+#include <array>
+#include <string>
+
+/// Int as eight 32 bit digits, least significant first.
+using Digits = std::array<uint32_t, 8>;
+
+inline Digits digits(Int const& _value)
+{
+	Digits result;
+	for (size_t i = 0; i < 8; i++)
+		result[i] = uint32_t(_value.data[i / 2] >> (32 * (i % 2)));
+	return result;
+}
+
+inline Int fromDigits(Digits const& _digits)
+{
+	Int result;
+	for (size_t i = 0; i < 8; i++)
+		result.data[i / 2] |= uint64_t(_digits[i]) << (32 * (i % 2));
+	return result;
+}
+
+inline Int referenceAdd(Int const& _a, Int const& _b)
+{
+	Digits a = digits(_a);
+	Digits b = digits(_b);
+	Digits sum;
+	uint64_t carry = 0;
+	for (size_t i = 0; i < 8; i++)
+	{
+		uint64_t x = uint64_t(a[i]) + b[i] + carry;
+		sum[i] = uint32_t(x);
+		carry = x >> 32;
+	}
+	return fromDigits(sum);
+}
+
+inline Int referenceSubtract(Int const& _a, Int const& _b)
+{
+	Digits a = digits(_a);
+	Digits b = digits(_b);
+	Digits difference;
+	uint64_t borrow = 0;
+	for (size_t i = 0; i < 8; i++)
+	{
+		uint64_t x = uint64_t(a[i]) - b[i] - borrow;
+		difference[i] = uint32_t(x);
+		borrow = (x >> 32) & 1;
+	}
+	return fromDigits(difference);
+}
+
+inline Int referenceMultiply(Int const& _a, uint32_t _b)
+{
+	Digits a = digits(_a);
+	Digits product;
+	uint64_t carry = 0;
+	for (size_t i = 0; i < 8; i++)
+	{
+		uint64_t x = uint64_t(a[i]) * _b + carry;
+		product[i] = uint32_t(x);
+		carry = x >> 32;
+	}
+	return fromDigits(product);
+}
+
+inline Int referenceDivide(Int const& _a, uint32_t _b)
+{
+	Digits a = digits(_a);
+	Digits quotient;
+	uint64_t remainder = 0;
+	for (size_t i = 8; i-- > 0;)
+	{
+		uint64_t x = (remainder << 32) | a[i];
+		quotient[i] = uint32_t(x / _b);
+		remainder = x % _b;
+	}
+	return fromDigits(quotient);
+}
+
+/// @returns the decimal representation of @a _value.
+inline std::string referenceToString(Int _value)
+{
+	std::string result;
+	do
+	{
+		Int quotient = referenceDivide(_value, 10);
+		result.insert(result.begin(), char('0' + referenceSubtract(_value, referenceMultiply(quotient, 10)).data[0]));
+		_value = quotient;
+	}
+	while (_value != Int(0));
+	return result;
+}
+
+/// @returns the value of the decimal digits @a _digits modulo 2^256.
+inline Int referenceFromString(std::string const& _digits)
+{
+	Int result;
+	for (char digit: _digits)
+		result = referenceAdd(referenceMultiply(result, 10), Int(uint64_t(digit - '0')));
+	return result;
+}
@@ -0,0 +1,101 @@
+#include "arena.h"
+
+#include "exceptions.h"
+
+#include <algorithm>
+#include <atomic>
+
+using namespace std;
+
+static atomic<uint64_t> _arenaQueries{0};
+static atomic<uint64_t> _arenaPeakBytes{0};
+static atomic<uint64_t> _arenaTotalBytes{0};
+
+void* Arena::allocate(size_t _bytes, size_t _alignment)
+{
+	require(_alignment > 0 && (_alignment & (_alignment - 1)) == 0 && _alignment <= alignof(max_align_t));
+	size_t offset = (m_offset + _alignment - 1) & ~(_alignment - 1);
+	if (m_block >= m_blocks.size() || offset + _bytes > m_blocks[m_block].size)
+	{
+		nextBlock(_bytes);
+		offset = 0;
+	}
+	m_used += offset - m_offset + _bytes;
+	m_offset = offset + _bytes;
+	return m_blocks[m_block].data.get() + offset;
+}
+
+void Arena::rewind(Mark const& _mark)
+{
+	m_peak = peak();
+	m_block = _mark.block;
+	m_offset = _mark.offset;
+	m_used = _mark.used;
+}
+
+Arena& Arena::forThread()
+{
+	thread_local Arena arena;
+	return arena;
+}
+
+void Arena::nextBlock(size_t _bytes)
+{
+	size_t next = m_blocks.empty() ? 0 : m_block + 1;
+	auto it = find_if(m_blocks.begin() + ptrdiff_t(next), m_blocks.end(), [&](Block const& _block) {
+		return _block.size >= _bytes;
+	});
+	if (it != m_blocks.end())
+		swap(*it, m_blocks[next]);
+	else
+	{
+		// Doubles the capacity, so a query needs few blocks even if it is large.
+		Block block;
+		block.size = max({_bytes, BlockSize, m_capacity});
+		block.data.reset(new char[block.size]);
+		m_capacity += block.size;
+		m_blocks.insert(m_blocks.begin() + ptrdiff_t(next), move(block));
+	}
+	m_block = next;
+	m_offset = 0;
+}
+
+ArenaScope::ArenaScope(Arena& _arena, bool _query):
+	m_arena(_arena),
+	m_mark(_arena.mark()),
+	m_query(_query)
+{
+	if (m_query)
+	{
+		m_outerPeak = m_arena.peak();
+		m_arena.m_peak = m_arena.m_used;
+	}
+}
+
+ArenaScope::~ArenaScope()
+{
+	if (m_query)
+	{
+		size_t peak = m_arena.peak();
+		recordArenaQuery(peak - m_mark.used);
+		m_arena.rewind(m_mark);
+		m_arena.m_peak = max(m_outerPeak, peak);
+	}
+	else
+		m_arena.rewind(m_mark);
+}
+
+ArenaStatistics arenaStatistics()
+{
+	return ArenaStatistics{_arenaQueries.load(), _arenaPeakBytes.load(), _arenaTotalBytes.load()};
+}
+
+void recordArenaQuery(uint64_t _bytes)
+{
+	_arenaQueries++;
+	_arenaTotalBytes += _bytes;
+	uint64_t peak = _arenaPeakBytes.load();
+	while (peak < _bytes && !_arenaPeakBytes.compare_exchange_weak(peak, _bytes))
+	{
+	}
+}
@@ -0,0 +1,142 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+/// Monotonic allocator for the scratch data of queries.
+///
+/// Memory is handed out from large blocks by bumping an offset and is only
+/// released all at once, by rewinding to a mark taken earlier, which takes
+/// constant time. The blocks are kept for later queries, so a thread that
+/// answers one query after another stops allocating once its arena is large
+/// enough, and the scratch data does not fragment the heap.
+/// Destructors are not run, so it is only meant for trivially destructible data
+/// and for containers using ArenaAllocator.
+class Arena
+{
+public:
+	/// Position in the arena, see mark().
+	struct Mark
+	{
+		size_t block = 0;
+		size_t offset = 0;
+		size_t used = 0;
+	};
+
+	Arena() = default;
+	Arena(Arena const&) = delete;
+	Arena& operator=(Arena const&) = delete;
+
+	/// @returns @a _bytes of memory aligned to @a _alignment, which has
+	/// to be a power of two no larger than `alignof(std::max_align_t)`.
+	void* allocate(size_t _bytes, size_t _alignment);
+	/// @returns uninitialized memory for @a _count objects of type T.
+	template <class T>
+	T* allocate(size_t _count) { return static_cast<T*>(allocate(_count * sizeof(T), alignof(T))); }
+
+	/// @returns the current position, everything allocated after it can be released by rewind().
+	Mark mark() const { return Mark{m_block, m_offset, m_used}; }
+	/// Releases everything that was allocated since @a _mark was taken.
+	void rewind(Mark const& _mark);
+
+	/// @returns the number of bytes in use, including padding for alignment.
+	size_t used() const { return m_used; }
+	/// @returns the most bytes that were in use at once, see used().
+	size_t peak() const { return std::max(m_peak, m_used); }
+	/// @returns the size of all blocks.
+	size_t capacity() const { return m_capacity; }
+
+	/// @returns the arena of the calling thread.
+	static Arena& forThread();
+
+private:
+	friend class ArenaScope;
+
+	/// Minimum size of a block.
+	static constexpr size_t BlockSize = 64 * 1024;
+
+	struct Block
+	{
+		std::unique_ptr<char[]> data;
+		size_t size = 0;
+	};
+
+	/// Continues in a free block of at least @a _bytes, allocating one if there is none.
+	void nextBlock(size_t _bytes);
+
+	/// The current block is `m_blocks[m_block]`, the ones after it are free.
+	std::vector<Block> m_blocks;
+	size_t m_block = 0;
+	size_t m_offset = 0;
+	size_t m_used = 0;
+	/// Most bytes in use before the last rewind, see peak().
+	size_t m_peak = 0;
+	size_t m_capacity = 0;
+};
+
+/// Releases everything allocated from an arena during its lifetime.
+class ArenaScope
+{
+public:
+	/// @param _query counts the memory used during the scope as one query in
+	/// arenaStatistics(). Only meant for the outermost scope of a query, not
+	/// for the ones that reuse memory within it.
+	explicit ArenaScope(Arena& _arena, bool _query = false);
+	~ArenaScope();
+	ArenaScope(ArenaScope const&) = delete;
+	ArenaScope& operator=(ArenaScope const&) = delete;
+
+private:
+	Arena& m_arena;
+	Arena::Mark m_mark;
+	bool m_query = false;
+	/// Peak of the arena before the scope, which is restored afterwards.
+	size_t m_outerPeak = 0;
+};
+
+/// Allocator for standard containers that draws from an Arena.
+/// Deallocation does nothing, the memory is only reused after the arena is rewound.
+template <class T>
+struct ArenaAllocator
+{
+	using value_type = T;
+
+	Arena* arena = nullptr;
+
+	ArenaAllocator(Arena& _arena): arena(&_arena) {}
+	template <class U>
+	ArenaAllocator(ArenaAllocator<U> const& _other): arena(_other.arena) {}
+
+	T* allocate(size_t _count) { return arena->allocate<T>(_count); }
+	void deallocate(T*, size_t) {}
+
+	template <class U>
+	bool operator==(ArenaAllocator<U> const& _other) const { return arena == _other.arena; }
+	template <class U>
+	bool operator!=(ArenaAllocator<U> const& _other) const { return arena != _other.arena; }
+};
+
+template <class T>
+using ArenaVector = std::vector<T, ArenaAllocator<T>>;
+
+template <class Key, class Value>
+using ArenaMap = std::unordered_map<Key, Value, std::hash<Key>, std::equal_to<Key>, ArenaAllocator<std::pair<Key const, Value>>>;
+
+/// Memory used by the queries from their arenas so far, over all threads.
+/// Filled by recordArenaQuery().
+struct ArenaStatistics
+{
+	uint64_t queries = 0;
+	/// Most memory used by a single query.
+	uint64_t peakBytes = 0;
+	/// Sum of the memory used by each query.
+	uint64_t totalBytes = 0;
+};
+
+ArenaStatistics arenaStatistics();
+/// Counts a query that used at most @a _bytes of scratch memory at once in arenaStatistics().
+void recordArenaQuery(uint64_t _bytes);
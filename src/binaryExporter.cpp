@@ -0,0 +1,251 @@
+#include "binaryExporter.h"
+
+#include "encoding.h"
+#include "exceptions.h"
+#include "log.h"
+
+#include <algorithm>
+#include <sstream>
+
+using namespace std;
+
+// The flow graph section uses the in-memory layout.
+static_assert(__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__, "Snapshots are only supported on little-endian hosts.");
+
+/// @returns the entries of @a _map with the keys replaced by their file index, sorted by it.
+/// This makes the output independent of the address handles.
+template <class Map>
+vector<pair<uint32_t, typename Map::mapped_type>> sortedByIndex(Map const& _map, unordered_map<AddressId, uint32_t> const& _indices)
+{
+	vector<pair<uint32_t, typename Map::mapped_type>> entries;
+	entries.reserve(_map.size());
+	for (auto const& [key, value]: _map)
+		entries.emplace_back(_indices.at(key), value);
+	sort(entries.begin(), entries.end(), [](auto const& _a, auto const& _b) { return _a.first < _b.first; });
+	return entries;
+}
+
+void BinaryExporter::write(size_t _blockNumber, DB const& _db)
+{
+	log_debug("-> BinaryExporter::write(_blockNumber: %li)", _blockNumber);
+
+	collectAddresses(_db);
+
+	vector<pair<SnapshotSection, string>> sections;
+	ostringstream addresses;
+	writeAddresses(addresses);
+	sections.emplace_back(SnapshotSection::Addresses, addresses.str());
+	ostringstream safes;
+	writeSafes(safes, _db);
+	sections.emplace_back(SnapshotSection::Safes, safes.str());
+	if (!_db.hasPendingEdgeUpdates())
+	{
+		ostringstream graph;
+		writeFlowGraph(graph, _db.flowGraph());
+		sections.emplace_back(SnapshotSection::FlowGraph, graph.str());
+	}
+
+	auto align = [](size_t _offset) { return (_offset + 7) / 8 * 8; };
+
+	m_output.write(reinterpret_cast<char const*>(SnapshotMagic), sizeof(SnapshotMagic));
+	writeLittleEndian<4>(m_output, SnapshotVersion);
+	writeLittleEndian<8>(m_output, _blockNumber);
+	writeLittleEndian<4>(m_output, sections.size());
+	writeLittleEndian<4>(m_output, 0);
+	size_t offset = 24 + 24 * sections.size();
+	for (auto const& [id, data]: sections)
+	{
+		offset = align(offset);
+		writeLittleEndian<4>(m_output, uint32_t(id));
+		writeLittleEndian<4>(m_output, 0);
+		writeLittleEndian<8>(m_output, offset);
+		writeLittleEndian<8>(m_output, data.size());
+		offset += data.size();
+	}
+	offset = 24 + 24 * sections.size();
+	for (auto const& [id, data]: sections)
+	{
+		for (; offset < align(offset); offset++)
+			m_output.put(0);
+		m_output.write(data.data(), streamsize(data.size()));
+		offset += data.size();
+	}
+
+	log_debug("<- BinaryExporter::write(_blockNumber: %li)", _blockNumber);
+}
+
+void BinaryExporter::writeCompact(size_t _blockNumber, DB const& _db)
+{
+	log_debug("-> BinaryExporter::writeCompact(_blockNumber: %li)", _blockNumber);
+
+	collectAddresses(_db);
+
+	m_output.write(reinterpret_cast<char const*>(CompactMagic), sizeof(CompactMagic));
+	writeVarint(m_output, _blockNumber);
+	writeVarint(m_output, m_addresses.size());
+	for (AddressId id: m_addresses)
+		m_output.write(reinterpret_cast<char const*>(address(id).address.data()), 20);
+
+	writeVarint(m_output, _db.safes.size());
+	uint32_t previousIndex = 0;
+	for (auto const& [index, safe]: sortedByIndex(_db.safes, m_indices))
+	{
+		writeVarint(m_output, index - previousIndex);
+		previousIndex = index;
+		writeVarint(m_output, m_indices.at(safe.tokenAddress));
+
+		auto balances = sortedByIndex(safe.balances, m_indices);
+		writeVarint(m_output, balances.size());
+		uint32_t previous = 0;
+		for (auto const& [token, balance]: balances)
+		{
+			writeVarint(m_output, token - previous);
+			previous = token;
+			writeCompactInt(balance);
+		}
+
+		auto limits = sortedByIndex(safe.limitPercentage, m_indices);
+		writeVarint(m_output, limits.size());
+		previous = 0;
+		for (auto const& [sendTo, percentage]: limits)
+		{
+			require(percentage <= 100);
+			writeVarint(m_output, sendTo - previous);
+			previous = sendTo;
+			m_output.put(char(percentage));
+		}
+		m_output.put(safe.organization ? 1 : 0);
+	}
+
+	log_debug("<- BinaryExporter::writeCompact(_blockNumber: %li)", _blockNumber);
+}
+
+void BinaryExporter::collectAddresses(DB const& _db)
+{
+	m_addresses.clear();
+	m_indices.clear();
+	auto add = [&](AddressId _address) {
+		if (m_indices.emplace(_address, 0).second)
+			m_addresses.push_back(_address);
+	};
+	for (auto const& [user, safe]: _db.safes)
+	{
+		add(user);
+		add(safe.tokenAddress);
+		for (auto const& balance: safe.balances)
+			add(balance.first);
+		for (auto const& limit: safe.limitPercentage)
+			add(limit.first);
+	}
+	FlowGraphView graph = _db.flowGraph().view();
+	for (NodeId node = 0; node < graph.nodeCount; node++)
+		if (auto const* address = get_if<AddressId>(&graph.nodes[node]))
+			add(*address);
+		else
+		{
+			add(get<0>(get<1>(graph.nodes[node])));
+			add(get<1>(get<1>(graph.nodes[node])));
+		}
+
+	sort(m_addresses.begin(), m_addresses.end(), [](AddressId _a, AddressId _b) {
+		return address(_a) < address(_b);
+	});
+	require(m_addresses.size() < NoNode);
+	for (size_t i = 0; i < m_addresses.size(); i++)
+		m_indices[m_addresses[i]] = uint32_t(i);
+}
+
+void BinaryExporter::writeSize(ostream& _os, size_t _value)
+{
+	require(_value <= 0xffffffff);
+	_os << BigEndian<4>(uint64_t(_value));
+}
+
+void BinaryExporter::writeAddress(ostream& _os, AddressId _address)
+{
+	writeSize(_os, m_indices.at(_address));
+}
+
+void BinaryExporter::writeInt(ostream& _os, Int const& _value)
+{
+	auto byte = [&](size_t _i) { return uint8_t(_value.data[_i / 8] >> ((_i * 8) % 64)); };
+	size_t bytes = 32;
+	while (bytes > 1 && byte(bytes - 1) == 0)
+		bytes--;
+	_os.put(char(bytes));
+	for (size_t i = bytes; i > 0; --i)
+		_os.put(char(byte(i - 1)));
+}
+
+void BinaryExporter::writeCompactInt(Int const& _value)
+{
+	auto byte = [&](size_t _i) { return uint8_t(_value.data[_i / 8] >> ((_i * 8) % 64)); };
+	size_t bytes = 32;
+	while (bytes > 0 && byte(bytes - 1) == 0)
+		bytes--;
+	m_output.put(char(bytes));
+	for (size_t i = bytes; i > 0; --i)
+		m_output.put(char(byte(i - 1)));
+}
+
+void BinaryExporter::writeAddresses(ostream& _os)
+{
+	writeSize(_os, m_addresses.size());
+	for (AddressId id: m_addresses)
+		_os.write(reinterpret_cast<char const*>(address(id).address.data()), 20);
+}
+
+void BinaryExporter::writeSafes(ostream& _os, DB const& _db)
+{
+	writeSize(_os, _db.safes.size());
+	for (auto const& [index, safe]: sortedByIndex(_db.safes, m_indices))
+	{
+		writeSize(_os, index);
+		writeAddress(_os, safe.tokenAddress);
+		auto balances = sortedByIndex(safe.balances, m_indices);
+		writeSize(_os, balances.size());
+		for (auto const& [token, balance]: balances)
+		{
+			writeSize(_os, token);
+			writeInt(_os, balance);
+		}
+		auto limits = sortedByIndex(safe.limitPercentage, m_indices);
+		writeSize(_os, limits.size());
+		for (auto const& [sendTo, percentage]: limits)
+		{
+			writeSize(_os, sendTo);
+			writeSize(_os, percentage);
+		}
+		_os.put(safe.organization ? 1 : 0);
+	}
+}
+
+void BinaryExporter::writeFlowGraph(ostream& _os, FlowGraph const& _graph)
+{
+	FlowGraph graph = _graph;
+	graph.compact();
+	FlowGraphView view = graph.view();
+	size_t arcCount = graph.arcCount();
+
+	writeLittleEndian<8>(_os, view.nodeCount);
+	writeLittleEndian<8>(_os, arcCount);
+	_os.write(reinterpret_cast<char const*>(view.capacities), streamsize(arcCount * sizeof(Int)));
+	for (NodeId node = 0; node < view.nodeCount; node++)
+		if (auto const* address = get_if<AddressId>(&view.nodes[node]))
+		{
+			writeLittleEndian<4>(_os, m_indices.at(*address));
+			writeLittleEndian<4>(_os, NoNode);
+		}
+		else
+		{
+			auto const& [from, token] = get<1>(view.nodes[node]);
+			writeLittleEndian<4>(_os, m_indices.at(from));
+			writeLittleEndian<4>(_os, m_indices.at(token));
+		}
+	// After compaction, the arcs of consecutive nodes are adjacent.
+	_os.write(reinterpret_cast<char const*>(view.arcBegin), streamsize(view.nodeCount * sizeof(ArcId)));
+	writeLittleEndian<4>(_os, arcCount);
+	_os.write(reinterpret_cast<char const*>(view.targets), streamsize(arcCount * sizeof(NodeId)));
+	_os.write(reinterpret_cast<char const*>(view.reverse), streamsize(arcCount * sizeof(ArcId)));
+	_os.write(reinterpret_cast<char const*>(view.byCapacity), streamsize(arcCount * sizeof(ArcId)));
+}
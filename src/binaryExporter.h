@@ -0,0 +1,64 @@
+#pragma once
+
+#include <iostream>
+#include <unordered_map>
+
+#include "types.h"
+#include "db.h"
+
+/// Writes snapshots of the DB that BinaryImporter can read.
+///
+/// The snapshot format (version 2) consists of a header, a section table
+/// and the sections, which start at multiples of eight bytes:
+///  - header: SnapshotMagic, version (uint32), block number (uint64),
+///    section count (uint32), zero (uint32)
+///  - per section: SnapshotSection (uint32), zero (uint32),
+///    offset from the start of the file (uint64), size (uint64)
+/// All numbers in the header and section table are little-endian.
+///
+/// The address and safe sections use the encoding of version 1. The flow graph
+/// section contains the arrays of the compacted FlowGraph in their in-memory
+/// layout on little-endian hosts, so that they can be loaded by copying:
+///  - node count, arc count (uint64)
+///  - capacities (32 bytes per arc, least significant word first)
+///  - nodes (two uint32 per node: address index and token index, or 0xffffffff for actual nodes)
+///  - offsets of the arcs of each node (node count + 1 uint32)
+///  - targets, reverse arcs and the byCapacity order (one uint32 per arc each)
+class BinaryExporter
+{
+public:
+	explicit BinaryExporter(std::ostream& _output): m_output(_output) {}
+
+	/// Writes a snapshot of @a _db at @a _blockNumber.
+	/// The flow graph is left out if there are pending edge updates.
+	void write(size_t _blockNumber, DB const& _db);
+
+	/// Writes @a _db at @a _blockNumber in the compact encoding, which is optimized
+	/// for size and does not contain the flow graph:
+	///  - CompactMagic, block number, address count, the addresses (20 bytes each)
+	///  - safe count, then per safe (ordered by address index):
+	///    address index, token index, balance count, per balance token index and value,
+	///    limit count, per limit address index and percentage (one byte), organization flag (one byte)
+	/// Numbers are varints (see writeVarint), values are a length byte followed by the
+	/// significant bytes, most significant first. Sorted lists of address indices
+	/// store the difference to the previous index (or to zero).
+	void writeCompact(size_t _blockNumber, DB const& _db);
+
+private:
+	/// Assigns file indices to all addresses referenced by @a _db, in address order.
+	void collectAddresses(DB const& _db);
+
+	void writeSize(std::ostream& _os, size_t _value);
+	void writeAddress(std::ostream& _os, AddressId _address);
+	void writeInt(std::ostream& _os, Int const& _value);
+
+	void writeAddresses(std::ostream& _os);
+	void writeSafes(std::ostream& _os, DB const& _db);
+	void writeFlowGraph(std::ostream& _os, FlowGraph const& _graph);
+	void writeCompactInt(Int const& _value);
+
+	std::ostream& m_output;
+	/// File index to address handle.
+	std::vector<AddressId> m_addresses;
+	std::unordered_map<AddressId, uint32_t> m_indices;
+};
@@ -4,78 +4,239 @@
 #include "exceptions.h"
 #include "log.h"
 
+#include <algorithm>
+#include <cstring>
+#include <iterator>
 #include <utility>
 
 using namespace std;
 
+// The flow graph section of versioned snapshots uses the in-memory layout.
+static_assert(__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__, "Snapshots are only supported on little-endian hosts.");
+
 pair<size_t, DB> BinaryImporter::readBlockNumberAndDB()
 {
     log_debug("-> readBlockNumberAndDB()");
 
+	if (size_t(m_end - m_pos) >= sizeof(SnapshotMagic) && equal(begin(SnapshotMagic), end(SnapshotMagic), m_pos))
+	{
+		auto result = readSnapshot();
+		log_debug("<- readBlockNumberAndDB()");
+		return result;
+	}
+	if (size_t(m_end - m_pos) >= sizeof(CompactMagic) && equal(begin(CompactMagic), end(CompactMagic), m_pos))
+	{
+		auto result = readCompact();
+		log_debug("<- readBlockNumberAndDB()");
+		return result;
+	}
+
 	size_t blockNumber = readSize();
 	readAddresses();
 
 	DB db;
+	readSafes(db);
+
+	db.computeEdges();
+
+    log_debug("<- readBlockNumberAndDB()");
+
+	return {blockNumber, move(db)};
+}
+
+pair<size_t, DB> BinaryImporter::readSnapshot()
+{
+	size_t blockNumber = readSectionTable();
+
+	require(enterSection(SnapshotSection::Addresses));
+	readAddresses();
+
+	DB db;
+	require(enterSection(SnapshotSection::Safes));
+	readSafes(db);
+
+	if (enterSection(SnapshotSection::FlowGraph))
+		db.setFlowGraph(readFlowGraph());
+	else
+		db.computeEdges();
+
+	m_pos = m_end = m_begin + m_length;
+	return {blockNumber, move(db)};
+}
+
+size_t BinaryImporter::readMappedFlowGraph(
+	FlowGraphView& _graph,
+	vector<FlowGraphNode>& _nodes,
+	vector<NodeId>& _addressNodes,
+	vector<AddressId>& _tokenOwners
+)
+{
+	log_debug("-> readMappedFlowGraph()");
+
+	require(size_t(m_end - m_pos) >= sizeof(SnapshotMagic) && equal(begin(SnapshotMagic), end(SnapshotMagic), m_pos));
+	size_t blockNumber = readSectionTable();
+
+	require(enterSection(SnapshotSection::Addresses));
+	readAddresses();
+
+	require(enterSection(SnapshotSection::Safes));
+	_tokenOwners.clear();
 	size_t numSafes = readSize();
 	for (size_t i = 0; i < numSafes; ++i)
 	{
-		auto const& [address, s] = readSafe();
+		auto const& [address, safe] = readSafe();
+		if (_tokenOwners.size() <= safe.tokenAddress)
+			_tokenOwners.resize(safe.tokenAddress + 1, AddressTable::Zero);
+		_tokenOwners[safe.tokenAddress] = address;
+	}
+
+	require(enterSection(SnapshotSection::FlowGraph));
+	size_t nodeCount = size_t(fromLittleEndian<8>(take(8)));
+	size_t arcCount = size_t(fromLittleEndian<8>(take(8)));
+	require(nodeCount < NoNode && arcCount < NoArc);
+
+	_graph = FlowGraphView{};
+	_graph.nodeCount = nodeCount;
+	_graph.capacities = readArrayInPlace<Int>(arcCount);
+	_nodes = readNodes(nodeCount);
+	_graph.nodes = _nodes.data();
+	ArcId const* offsets = readArrayInPlace<ArcId>(nodeCount + 1);
+	require(offsets[0] == 0 && offsets[nodeCount] == arcCount);
+	// The arcs of consecutive nodes are adjacent.
+	_graph.arcBegin = offsets;
+	_graph.arcEnd = offsets + 1;
+	_graph.targets = readArrayInPlace<NodeId>(arcCount);
+	_graph.reverse = readArrayInPlace<ArcId>(arcCount);
+	_graph.byCapacity = readArrayInPlace<ArcId>(arcCount);
+	_graph.validate(arcCount);
+
+	_addressNodes.clear();
+	for (NodeId node = 0; node < nodeCount; node++)
+		if (auto const* address = get_if<AddressId>(&_nodes[node]))
+		{
+			if (_addressNodes.size() <= *address)
+				_addressNodes.resize(*address + 1, NoNode);
+			require(_addressNodes[*address] == NoNode);
+			_addressNodes[*address] = node;
+		}
+	_graph.addressNodes = _addressNodes.data();
+	_graph.addressCount = _addressNodes.size();
+
+	m_pos = m_end = m_begin + m_length;
+	log_debug("<- readMappedFlowGraph()");
+	return blockNumber;
+}
+
+size_t BinaryImporter::readSectionTable()
+{
+	take(sizeof(SnapshotMagic));
+	require(fromLittleEndian<4>(take(4)) == SnapshotVersion);
+	size_t blockNumber = size_t(fromLittleEndian<8>(take(8)));
+	size_t sectionCount = size_t(fromLittleEndian<4>(take(4)));
+	take(4);
+
+	m_sections.clear();
+	for (size_t i = 0; i < sectionCount; i++)
+	{
+		auto id = SnapshotSection(fromLittleEndian<4>(take(4)));
+		take(4);
+		size_t offset = size_t(fromLittleEndian<8>(take(8)));
+		size_t size = size_t(fromLittleEndian<8>(take(8)));
+		require(offset <= m_length && size <= m_length - offset);
+		m_sections[id] = {offset, size};
+	}
+	return blockNumber;
+}
+
+bool BinaryImporter::enterSection(SnapshotSection _section)
+{
+	auto it = m_sections.find(_section);
+	if (it == m_sections.end())
+		return false;
+	m_pos = m_begin + it->second.first;
+	m_end = m_pos + it->second.second;
+	return true;
+}
+
+pair<size_t, DB> BinaryImporter::readCompact()
+{
+	take(sizeof(CompactMagic));
+	size_t blockNumber = size_t(readVarint());
+
+	size_t addressCount = size_t(readVarint());
+	require(addressCount <= size_t(m_end - m_pos) / 20);
+	m_addresses.reserve(addressCount);
+	for (size_t i = 0; i < addressCount; ++i)
+	{
+		Address address;
+		copy_n(take(20), 20, address.address.begin());
+		m_addresses.push_back(addressTable().intern(address));
+	}
+
+	DB db;
+	size_t numSafes = size_t(readVarint());
+	uint64_t previousIndex = 0;
+	for (size_t i = 0; i < numSafes; ++i)
+	{
+		auto const& [address, s] = readCompactSafe(previousIndex);
 		db.tokens[s.tokenAddress].safeAddress = address;
 		db.safes[address] = move(s);
 	}
 
 	db.computeEdges();
-
-    log_debug("<- readBlockNumberAndDB()");
-
 	return {blockNumber, move(db)};
 }
 
+uint8_t const* BinaryImporter::take(size_t _bytes)
+{
+	require(size_t(m_end - m_pos) >= _bytes);
+	uint8_t const* data = m_pos;
+	m_pos += _bytes;
+	return data;
+}
+
 bool BinaryImporter::readBool()
 {
-	return m_input.get() != 0;
+	return *take(1) != 0;
 }
 
 size_t BinaryImporter::readSize()
 {
-	uint64_t result{};
-	m_input >> BigEndian<4>(result);
-	return size_t(result);
+	return size_t(fromBigEndian<4>(take(4)));
 }
 
-Address BinaryImporter::readAddress()
+AddressId BinaryImporter::readAddress()
 {
-	uint64_t index{};
-	m_input >> BigEndian<4>(index);
-	return m_addresses.at(index);
+	return m_addresses.at(fromBigEndian<4>(take(4)));
 }
 
 Int BinaryImporter::readInt()
 {
-	int bytes = uint8_t(m_input.get());
+	int bytes = *take(1);
 	require(bytes <= 32 && bytes > 0);
+	uint8_t const* data = take(size_t(bytes));
 	Int v;
 	for (int i = bytes - 1; i >= 0; --i)
-		v.data[i / 8] |= uint64_t(uint8_t(m_input.get())) << ((i * 8) % 64);
+		v.data[i / 8] |= uint64_t(*data++) << ((i * 8) % 64);
 	return v;
 }
 
-pair<Address, Safe> BinaryImporter::readSafe()
+pair<AddressId, Safe> BinaryImporter::readSafe()
 {
 	Safe s;
-	Address address = readAddress();
+	AddressId address = readAddress();
 	s.tokenAddress = readAddress();
 	size_t numBalances = readSize();
 	for (size_t i = 0; i < numBalances; i++)
 	{
-		Address token = readAddress();
+		AddressId token = readAddress();
 		Int balance = readInt();
 		s.balances[token] = balance;
 	}
 	size_t numLimits = readSize();
 	for (size_t i = 0; i < numLimits; i++)
 	{
-		Address sendTo = readAddress();
+		AddressId sendTo = readAddress();
 		uint32_t percentage = readSize();
 		require(percentage <= 100);
 		if (percentage > 0)
@@ -85,14 +246,135 @@ pair<Address, Safe> BinaryImporter::readSafe()
 	return {address, s};
 }
 
+uint64_t BinaryImporter::readVarint()
+{
+	uint64_t result = 0;
+	for (unsigned shift = 0;; shift += 7)
+	{
+		require(shift < 64);
+		uint8_t byte = *take(1);
+		result |= uint64_t(byte & 0x7f) << shift;
+		if (!(byte & 0x80))
+			return result;
+	}
+}
+
+AddressId BinaryImporter::readAddressDelta(uint64_t& _previous)
+{
+	_previous += readVarint();
+	return m_addresses.at(_previous);
+}
+
+Int BinaryImporter::readCompactInt()
+{
+	size_t bytes = *take(1);
+	require(bytes <= 32);
+	uint8_t const* data = take(bytes);
+	Int v;
+	for (size_t i = bytes; i > 0; --i)
+		v.data[(i - 1) / 8] |= uint64_t(*data++) << (((i - 1) * 8) % 64);
+	return v;
+}
+
+pair<AddressId, Safe> BinaryImporter::readCompactSafe(uint64_t& _previousIndex)
+{
+	Safe s;
+	AddressId address = readAddressDelta(_previousIndex);
+	s.tokenAddress = m_addresses.at(readVarint());
+	size_t numBalances = size_t(readVarint());
+	uint64_t token = 0;
+	for (size_t i = 0; i < numBalances; i++)
+	{
+		AddressId tokenAddress = readAddressDelta(token);
+		s.balances[tokenAddress] = readCompactInt();
+	}
+	size_t numLimits = size_t(readVarint());
+	uint64_t sendTo = 0;
+	for (size_t i = 0; i < numLimits; i++)
+	{
+		AddressId sendToAddress = readAddressDelta(sendTo);
+		uint32_t percentage = *take(1);
+		require(percentage <= 100);
+		if (percentage > 0)
+			s.limitPercentage[sendToAddress] = percentage;
+	}
+	s.organization = readBool();
+	return {address, s};
+}
+
+void BinaryImporter::readSafes(DB& _db)
+{
+	size_t numSafes = readSize();
+	for (size_t i = 0; i < numSafes; ++i)
+	{
+		auto const& [address, s] = readSafe();
+		_db.tokens[s.tokenAddress].safeAddress = address;
+		_db.safes[address] = move(s);
+	}
+}
+
+template <class T>
+vector<T> BinaryImporter::readArray(size_t _count)
+{
+	require(_count <= size_t(m_end - m_pos) / sizeof(T));
+	vector<T> result(_count);
+	if (_count > 0)
+		memcpy(result.data(), take(_count * sizeof(T)), _count * sizeof(T));
+	return result;
+}
+
+template <class T>
+T const* BinaryImporter::readArrayInPlace(size_t _count)
+{
+	require(_count <= size_t(m_end - m_pos) / sizeof(T));
+	require(reinterpret_cast<uintptr_t>(m_pos) % alignof(T) == 0);
+	return reinterpret_cast<T const*>(take(_count * sizeof(T)));
+}
+
+vector<FlowGraphNode> BinaryImporter::readNodes(size_t _nodeCount)
+{
+	// Pairs of address indices, the second one is NoNode for actual nodes.
+	vector<uint32_t> nodeAddresses = readArray<uint32_t>(2 * _nodeCount);
+	vector<FlowGraphNode> nodes;
+	nodes.reserve(_nodeCount);
+	for (size_t i = 0; i < _nodeCount; i++)
+	{
+		AddressId address = m_addresses.at(nodeAddresses[2 * i]);
+		if (nodeAddresses[2 * i + 1] == NoNode)
+			nodes.emplace_back(address);
+		else
+			nodes.emplace_back(make_tuple(address, m_addresses.at(nodeAddresses[2 * i + 1])));
+	}
+	return nodes;
+}
+
+FlowGraph BinaryImporter::readFlowGraph()
+{
+	log_debug("-> readFlowGraph()");
+	size_t nodeCount = size_t(fromLittleEndian<8>(take(8)));
+	size_t arcCount = size_t(fromLittleEndian<8>(take(8)));
+	require(nodeCount < NoNode && arcCount < NoArc);
+
+	vector<Int> capacities = readArray<Int>(arcCount);
+	vector<FlowGraphNode> nodes = readNodes(nodeCount);
+	vector<ArcId> offsets = readArray<ArcId>(nodeCount + 1);
+	vector<NodeId> targets = readArray<NodeId>(arcCount);
+	vector<ArcId> reverse = readArray<ArcId>(arcCount);
+	vector<ArcId> byCapacity = readArray<ArcId>(arcCount);
+	log_debug("<- readFlowGraph()");
+	return FlowGraph::fromArrays(move(nodes), offsets, move(targets), move(capacities), move(reverse), move(byCapacity));
+}
+
 void BinaryImporter::readAddresses()
 {
     log_debug("-> readAddresses()");
 	size_t length = readSize();
+	m_addresses.reserve(length);
 	for (size_t i = 0; i < length; ++i)
 	{
-		m_addresses.push_back({});
-		m_input.read(reinterpret_cast<char*>(&(m_addresses.back().address[0])), 20);
+		Address address;
+		copy_n(take(20), 20, address.address.begin());
+		m_addresses.push_back(addressTable().intern(address));
 	}
     log_debug("<- readAddresses()");
 }
\ No newline at end of file
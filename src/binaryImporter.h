@@ -1,34 +1,86 @@
 #pragma once
 
-#include <iostream>
-#include <fstream>
+#include <cstdint>
 #include <utility>
 
 #include "types.h"
 #include "db.h"
+#include "encoding.h"
 
 class BinaryImporter
 {
 public:
-	explicit BinaryImporter(std::istream& _input): m_input(_input) {}
+	/// Reads from the @a _length bytes at @a _data, which have to stay valid
+	/// while the importer is used.
+	BinaryImporter(uint8_t const* _data, size_t _length):
+		m_begin(_data), m_length(_length), m_pos(_data), m_end(_data + _length)
+	{}
 
+	/// Reads a snapshot in either format (see BinaryExporter).
+	/// The flow graph is only computed if the snapshot does not contain it.
 	std::pair<size_t, DB> readBlockNumberAndDB();
-	std::set<Edge> readEdgeSet();
+
+	/// Reads the flow graph of a versioned snapshot without copying its arcs:
+	/// The arc arrays of @a _graph point into the input afterwards, only the
+	/// nodes (translated to the global address table) are stored in @a _nodes
+	/// and @a _addressNodes. Of the safes, only the owners of the tokens are
+	/// kept, in @a _tokenOwners (indexed by token).
+	/// Throws if the input is not a snapshot with a flow graph.
+	/// @returns the block number.
+	size_t readMappedFlowGraph(
+		FlowGraphView& _graph,
+		std::vector<FlowGraphNode>& _nodes,
+		std::vector<NodeId>& _addressNodes,
+		std::vector<AddressId>& _tokenOwners
+	);
 
 private:
+	/// Reads a versioned snapshot, i.e. one that starts with SnapshotMagic.
+	std::pair<size_t, DB> readSnapshot();
+	/// Reads the compact encoding, i.e. a file that starts with CompactMagic.
+	std::pair<size_t, DB> readCompact();
+
+	/// Reads the header and section table of a versioned snapshot.
+	/// @returns the block number.
+	size_t readSectionTable();
+	/// Restricts the input to @a _section.
+	/// @returns false if the snapshot does not contain it.
+	bool enterSection(SnapshotSection _section);
+
 	bool readBool();
 	size_t readSize();
-	Address readAddress();
+	AddressId readAddress();
 	Int readInt();
-	std::pair<Address, Safe> readSafe();
-	Token readToken();
-	Connection readConnection();
-	Edge readEdge();
+	std::pair<AddressId, Safe> readSafe();
 
-	Address const& address(size_t _index);
+	uint64_t readVarint();
+	/// Reads a varint and adds it to @a _previous.
+	/// @returns the address with that index in the file.
+	AddressId readAddressDelta(uint64_t& _previous);
+	Int readCompactInt();
+	std::pair<AddressId, Safe> readCompactSafe(uint64_t& _previousIndex);
 
 	void readAddresses();
+	void readSafes(DB& _db);
+	FlowGraph readFlowGraph();
+	std::vector<FlowGraphNode> readNodes(size_t _nodeCount);
+	/// Reads @a _count elements of @a T stored in their in-memory layout.
+	template <class T>
+	std::vector<T> readArray(size_t _count);
+	/// Like readArray, but returns a pointer into the input, which has to be aligned.
+	template <class T>
+	T const* readArrayInPlace(size_t _count);
+
+	/// Consumes @a _bytes bytes, throws if the input is too short.
+	/// @returns a pointer to them.
+	uint8_t const* take(size_t _bytes);
 
-	std::istream& m_input;
-	std::vector<Address> m_addresses;
+	uint8_t const* m_begin = nullptr;
+	size_t m_length = 0;
+	uint8_t const* m_pos = nullptr;
+	uint8_t const* m_end = nullptr;
+	/// Address index in the file to handle in the global address table.
+	std::vector<AddressId> m_addresses;
+	/// Offset and size of each section of a versioned snapshot.
+	std::map<SnapshotSection, std::pair<size_t, size_t>> m_sections;
 };
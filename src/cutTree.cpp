@@ -0,0 +1,165 @@
+#include "cutTree.h"
+
+#include "db.h"
+#include "flow.h"
+#include "log.h"
+
+#include <algorithm>
+#include <map>
+
+using namespace std;
+
+/// @returns the undirected relaxation of @a _graph as a flow graph where
+/// both arcs between two nodes have the sum of their capacities in @a _graph.
+FlowGraph undirectedRelaxation(FlowGraphView const& _graph)
+{
+	map<pair<NodeId, NodeId>, Int> capacities;
+	for (NodeId node = 0; node < _graph.nodeCount; node++)
+		for (ArcId arc = _graph.begin(node); arc < _graph.end(node); arc++)
+			if (Int(0) < _graph.capacities[arc])
+				capacities[minmax(node, _graph.targets[arc])] += _graph.capacities[arc];
+
+	vector<FlowGraphArc> arcs;
+	arcs.reserve(2 * capacities.size());
+	for (auto const& [nodes, capacity]: capacities)
+	{
+		arcs.emplace_back(_graph.nodes[nodes.first], _graph.nodes[nodes.second], capacity);
+		arcs.emplace_back(_graph.nodes[nodes.second], _graph.nodes[nodes.first], capacity);
+	}
+	return FlowGraph::fromArcs(arcs);
+}
+
+unique_ptr<CutTree> CutTree::build(
+	FlowGraphView const& _graph,
+	uint64_t _generation,
+	atomic<bool> const& _cancel
+)
+{
+	log_debug("-> CutTree::build(_generation: %li)", _generation);
+
+	FlowGraph undirected = undirectedRelaxation(_graph);
+	FlowGraphView view = undirected.view();
+
+	unique_ptr<CutTree> tree(new CutTree());
+	tree->m_generation = _generation;
+	tree->m_terminals.assign(view.addressCount, NoTerminal);
+	/// Tree node to graph node.
+	vector<NodeId> nodes;
+	for (AddressId address = 0; address < view.addressCount; address++)
+		if (view.addressNodes[address] != NoNode)
+		{
+			tree->m_terminals[address] = uint32_t(nodes.size());
+			nodes.push_back(view.addressNodes[address]);
+		}
+
+	// Gusfield's algorithm: Cut each node from its current parent and move the
+	// later nodes with the same parent that end up on its side below it.
+	tree->m_parent.assign(nodes.size(), 0);
+	tree->m_cut.assign(nodes.size(), Int(0));
+	ArenaScope scope(Arena::forThread());
+	ResidualGraph residual(view);
+	vector<bool> sourceSide;
+	for (uint32_t i = 1; i < nodes.size(); i++)
+	{
+		if (_cancel)
+		{
+			log_debug("<- CutTree::build(_generation: %li): cancelled", _generation);
+			return nullptr;
+		}
+		residual.reset();
+		uint32_t parent = tree->m_parent[i];
+		tree->m_cut[i] = minCut(nodes[i], nodes[parent], residual, sourceSide);
+		for (uint32_t j = i + 1; j < nodes.size(); j++)
+			if (sourceSide[nodes[j]] && tree->m_parent[j] == parent)
+				tree->m_parent[j] = i;
+	}
+
+	log_debug("<- CutTree::build(_generation: %li)", _generation);
+	return tree;
+}
+
+Int CutTree::upperBound(AddressId _source, AddressId _sink) const
+{
+	uint32_t a = _source < m_terminals.size() ? m_terminals[_source] : NoTerminal;
+	uint32_t b = _sink < m_terminals.size() ? m_terminals[_sink] : NoTerminal;
+	if (a == NoTerminal || b == NoTerminal || a == b)
+		return Int(0);
+	// Parents have smaller indices, so moving up the larger one meets at the common ancestor.
+	Int bound = Int::max();
+	while (a != b)
+	{
+		uint32_t& deeper = a > b ? a : b;
+		bound = min(bound, m_cut[deeper]);
+		deeper = m_parent[deeper];
+	}
+	return bound;
+}
+
+CutTreeBuilder::CutTreeBuilder()
+{
+#ifndef __EMSCRIPTEN__
+	m_worker = thread([this]() { work(); });
+#endif
+}
+
+CutTreeBuilder::~CutTreeBuilder()
+{
+	{
+		lock_guard<mutex> lock(m_mutex);
+		m_stopping = true;
+		m_cancel = true;
+	}
+	m_condition.notify_all();
+	if (m_worker.joinable())
+		m_worker.join();
+}
+
+void CutTreeBuilder::update(shared_ptr<GraphVersion const> _version, bool _discard)
+{
+#ifdef __EMSCRIPTEN__
+	if (_discard)
+		atomic_store(&m_current, shared_ptr<CutTree const>());
+	shared_ptr<CutTree const> tree = CutTree::build(_version->graph.view(), _version->generation, m_cancel);
+	atomic_store(&m_current, move(tree));
+#else
+	{
+		lock_guard<mutex> lock(m_mutex);
+		m_pending = move(_version);
+		if (_discard)
+		{
+			m_epoch++;
+			m_cancel = true;
+			atomic_store(&m_current, shared_ptr<CutTree const>());
+		}
+	}
+	m_condition.notify_all();
+#endif
+}
+
+void CutTreeBuilder::work()
+{
+	while (true)
+	{
+		shared_ptr<GraphVersion const> version;
+		uint64_t epoch = 0;
+		{
+			unique_lock<mutex> lock(m_mutex);
+			m_condition.wait(lock, [&]() { return m_stopping || m_pending; });
+			if (m_stopping)
+				return;
+			version = move(m_pending);
+			m_pending = nullptr;
+			m_cancel = false;
+			epoch = m_epoch;
+		}
+		shared_ptr<CutTree const> tree = CutTree::build(version->graph.view(), version->generation, m_cancel);
+		if (tree)
+		{
+			lock_guard<mutex> lock(m_mutex);
+			if (epoch != m_epoch)
+				continue;
+			atomic_store(&m_current, move(tree));
+			log_info("-* CutTreeBuilder: tree of generation %li is ready", version->generation);
+		}
+	}
+}
@@ -0,0 +1,96 @@
+#pragma once
+
+#include "flowGraph.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+struct GraphVersion;
+
+/// Gomory-Hu cut tree of the undirected relaxation of a flow graph, in which
+/// the capacity between two nodes is the sum of the capacities of the arcs
+/// between them in both directions.
+///
+/// The min cut between two addresses in the relaxation is at least the max
+/// flow between them in either direction, so the tree answers upper bounds
+/// on flows by walking the path between them. In particular, a bound of zero
+/// means that nothing can be sent at all.
+/// Only the actual nodes (addresses) are part of the tree, the pseudo-nodes
+/// only take part in the cuts.
+class CutTree
+{
+public:
+	/// Builds the tree of @a _graph, which is the graph of DB generation @a _generation.
+	/// This computes one max flow per address. If @a _cancel is set in the
+	/// meantime, it stops and returns nullptr.
+	static std::unique_ptr<CutTree> build(
+		FlowGraphView const& _graph,
+		uint64_t _generation,
+		std::atomic<bool> const& _cancel
+	);
+
+	/// @returns the generation of the graph the tree was built from.
+	uint64_t generation() const { return m_generation; }
+
+	/// @returns an upper bound on the max flow between @a _source and @a _sink
+	/// in the graph the tree was built from. Zero if one of them is not part of it.
+	Int upperBound(AddressId _source, AddressId _sink) const;
+
+private:
+	static constexpr uint32_t NoTerminal = uint32_t(-1);
+
+	CutTree() = default;
+
+	uint64_t m_generation = 0;
+	/// Address handle to its index in the tree or NoTerminal.
+	std::vector<uint32_t> m_terminals;
+	/// Parent of each tree node, which always has a smaller index. The root is 0.
+	std::vector<uint32_t> m_parent;
+	/// Min cut between each tree node and its parent.
+	std::vector<Int> m_cut;
+};
+
+/// Keeps a CutTree up to date with the versions of a graph, on a background thread.
+///
+/// Building a tree takes a max flow computation per address, so after a
+/// change, the tree lags behind the graph for a while. Users have to compare
+/// its generation to the one they query (see CutTree::generation()).
+/// A running build is not cancelled by newer versions, but the tree of the
+/// newest one is built after it, so trees keep being finished while the graph
+/// changes more often than they can be built.
+/// Without thread support, trees are built on the calling thread instead.
+class CutTreeBuilder
+{
+public:
+	CutTreeBuilder();
+	/// Cancels the running build.
+	~CutTreeBuilder();
+	CutTreeBuilder(CutTreeBuilder const&) = delete;
+	CutTreeBuilder& operator=(CutTreeBuilder const&) = delete;
+
+	/// Requests a tree for @a _version, replacing any pending request.
+	/// @param _discard drops the current tree right away and cancels the running
+	/// build, e.g. because a different DB was loaded.
+	void update(std::shared_ptr<GraphVersion const> _version, bool _discard = false);
+
+	/// @returns the most recently built tree or nullptr if there is none yet.
+	std::shared_ptr<CutTree const> current() const { return std::atomic_load(&m_current); }
+
+private:
+	void work();
+
+	std::mutex m_mutex;
+	std::condition_variable m_condition;
+	std::shared_ptr<GraphVersion const> m_pending;
+	std::atomic<bool> m_cancel{false};
+	bool m_stopping = false;
+	/// Incremented whenever the current tree is discarded, so that a build
+	/// that started before is not stored.
+	uint64_t m_epoch = 0;
+	/// Only replaced with m_mutex locked, but read without it.
+	std::shared_ptr<CutTree const> m_current;
+	std::thread m_worker;
+};
@@ -2,48 +2,51 @@
 #include "exceptions.h"
 #include "db.h"
 #include "log.h"
+#include "parallel.h"
+
+#include <algorithm>
 
 using namespace std;
 
-Int Safe::balance(Address const& _token) const
+Int Safe::balance(AddressId _token) const
 {
 	auto it = balances.find(_token);
 	return it == balances.end() ? Int{0} : it->second;
 }
 
-uint32_t Safe::sendToPercentage(Address const& _sendTo) const
+uint32_t Safe::sendToPercentage(AddressId _sendTo) const
 {
 	auto it = limitPercentage.find(_sendTo);
 	return it == limitPercentage.end() ? 0 : it->second;
 }
 
-Safe const& DB::safe(Address const& _address) const
+Safe const& DB::safe(AddressId _address) const
 {
 	auto it = safes.find(_address);
 	require(it != safes.end());
 	return it->second;
 }
 
-Token const& DB::token(Address const& _address) const
+Token const& DB::token(AddressId _address) const
 {
 	auto it = tokens.find(_address);
 	require(it != tokens.end());
 	return it->second;
 }
 
-Token const* DB::tokenMaybe(Address const& _address) const
+Token const* DB::tokenMaybe(AddressId _address) const
 {
 	auto it = tokens.find(_address);
 	return it == tokens.end() ? nullptr : &it->second;
 }
 
-Token* DB::tokenMaybe(Address const& _address)
+Token* DB::tokenMaybe(AddressId _address)
 {
 	auto it = tokens.find(_address);
 	return it == tokens.end() ? nullptr : &it->second;
 }
 
-Int DB::limit(Address const& _user, Address const& _canSendTo) const
+Int DB::limit(AddressId _user, AddressId _canSendTo) const
 {
 	Safe const* senderSafe = safeMaybe(_user);
 	Safe const* receiverSafe = safeMaybe(_canSendTo);
@@ -68,6 +71,34 @@ Int DB::limit(Address const& _user, Address const& _canSendTo) const
 	return min(amount, senderSafe->balance(senderSafe->tokenAddress));
 }
 
+set<AddressId> const& DB::senders(AddressId _sendTo) const
+{
+	static set<AddressId> const empty;
+	auto it = m_senders.find(_sendTo);
+	return it == m_senders.end() ? empty : it->second;
+}
+
+set<AddressId> const& DB::holders(AddressId _token) const
+{
+	static set<AddressId> const empty;
+	auto it = m_holders.find(_token);
+	return it == m_holders.end() ? empty : it->second;
+}
+
+void DB::computeIndices()
+{
+	m_senders.clear();
+	m_holders.clear();
+	for (auto const& [user, safe]: safes)
+	{
+		for (auto const& [sendTo, percentage]: safe.limitPercentage)
+			m_senders[sendTo].insert(user);
+		for (auto const& [token, balance]: safe.balances)
+			if (balance != Int(0))
+				m_holders[token].insert(user);
+	}
+}
+
 void DB::computeEdges()
 {
 	log_debug("-> DB::computeEdges()");
@@ -75,24 +106,107 @@ void DB::computeEdges()
 
 	time_t start = time(NULL);
 
-	m_edges.clear();
-	m_flowGraph.clear();
-
-	for (auto const& safe: safes) {
-		computeEdgesFrom(safe.first);
+	// Every thread collects the arcs of a contiguous range of safes,
+	// and the ranges are concatenated in order.
+	vector<AddressId> users;
+	users.reserve(safes.size());
+	for (auto const& safe: safes)
+		users.push_back(safe.first);
+	size_t threads = min(threadCount(), max<size_t>(users.size(), 1));
+	vector<vector<FlowGraphArc>> parts(threads);
+	parallelFor(threads, threads, [&](size_t _begin, size_t _end) {
+		for (size_t part = _begin; part < _end; part++)
+			for (size_t i = users.size() * part / threads; i < users.size() * (part + 1) / threads; i++)
+				computeEdgesFrom(users[i], parts[part]);
+	}, 1);
+
+	vector<FlowGraphArc> arcs;
+	size_t arcCount = 0;
+	for (auto const& part: parts)
+		arcCount += part.size();
+	arcs.reserve(arcCount);
+	for (auto& part: parts)
+	{
+		arcs.insert(arcs.end(), make_move_iterator(part.begin()), make_move_iterator(part.end()));
+		part = {};
 	}
+	setFlowGraph(FlowGraph::fromArcs(arcs));
 
 	time_t end = time(NULL);
 	auto dura = end - start;
-	auto duration = (unsigned long)dura;
+	auto duration = max<unsigned long>((unsigned long)dura, 1);
 	auto safesPerSec = safes.size() / duration;
-	auto edgesPerSec = m_edges.size() / duration;
+	auto edgesPerSec = m_edgeCount / duration;
 
-	log_debug("   DB::computeEdges(): Computed %li edges in %li seconds (%i edges/s; %i safes/s)", m_edges.size(), duration, edgesPerSec, safesPerSec);
+	log_debug("   DB::computeEdges(): Computed %li edges in %li seconds (%i edges/s; %i safes/s)", m_edgeCount, duration, edgesPerSec, safesPerSec);
 	log_debug("<- DB::computeEdges()");
 }
 
-void DB::computeEdgesFrom(Address const& _user)
+void DB::setFlowGraph(FlowGraph _graph)
+{
+	computeIndices();
+	m_dirtyTrustEdges.clear();
+	m_dirtyBalances.clear();
+
+	m_flowGraph = move(_graph);
+	m_edgeCount = m_flowGraph.view().edgeCount();
+	m_generation++;
+}
+
+vector<Edge> DB::edges() const
+{
+	vector<Edge> result;
+	result.reserve(m_edgeCount);
+	FlowGraphView graph = m_flowGraph.view();
+	for (NodeId node = 0; node < graph.nodeCount; node++)
+		if (auto const* pseudo = get_if<tuple<AddressId, AddressId>>(&graph.nodes[node]))
+			for (ArcId arc = graph.begin(node); arc < graph.end(node); arc++)
+				if (graph.capacities[arc] != Int(0))
+				{
+					auto const& [from, token] = *pseudo;
+					AddressId to = get<AddressId>(graph.nodes[graph.targets[arc]]);
+					result.push_back(Edge{from, to, token, graph.capacities[arc]});
+				}
+	sort(result.begin(), result.end());
+	return result;
+}
+
+void DB::setEdge(AddressId _from, AddressId _to, AddressId _token, Int const& _capacity)
+{
+	Int previous = m_flowGraph.setCapacity(make_tuple(_from, _token), _to, _capacity);
+	if (previous == _capacity)
+		return;
+	if (previous == Int(0))
+		m_edgeCount++;
+	else if (_capacity == Int(0))
+		m_edgeCount--;
+	m_generation++;
+}
+
+void DB::setTokenCapacity(AddressId _user, AddressId _token, Int const& _capacity)
+{
+	if (m_flowGraph.setCapacity(_user, make_tuple(_user, _token), _capacity) != _capacity)
+		m_generation++;
+}
+
+void DB::setArc(FlowGraphArc const& _arc)
+{
+	auto const& [from, to, capacity] = _arc;
+	if (auto const* pseudo = get_if<tuple<AddressId, AddressId>>(&from))
+		setEdge(get<0>(*pseudo), get<AddressId>(to), get<1>(*pseudo), capacity);
+	else
+		setTokenCapacity(get<AddressId>(from), get<1>(get<1>(to)), capacity);
+}
+
+void DB::computeEdgesFrom(AddressId _user)
+{
+	vector<FlowGraphArc> arcs;
+	computeEdgesFrom(_user, arcs);
+	for (FlowGraphArc const& arc: arcs)
+		setArc(arc);
+}
+
+void DB::computeEdgesFrom(AddressId _user, vector<FlowGraphArc>& _arcs) const
 {
 	//log_trace("-> DB::computeEdgesFrom(_user: '%s')", to_string(_user).c_str());
 
@@ -101,21 +215,24 @@ void DB::computeEdgesFrom(Address const& _user)
 		return;
 
 	// Edge from user to their own token, restricted by balance.
-	if (safe->tokenAddress != Address{})
-		m_flowGraph[_user][make_pair(_user, safe->tokenAddress)] = safe->balance(safe->tokenAddress);
+	if (safe->tokenAddress != AddressTable::Zero)
+	{
+		Int balance = safe->balance(safe->tokenAddress);
+		if (balance != Int(0))
+			_arcs.emplace_back(_user, make_tuple(_user, safe->tokenAddress), balance);
+	}
 
 	// Edges along trust connections.
 	for (auto const& trust: safe->limitPercentage)
 	{
-		Address const& sendTo = trust.first;
+		AddressId sendTo = trust.first;
 		if (_user == sendTo)
 			continue;
 		Int l = limit(_user, sendTo);
 		if (l == Int(0))
 			continue;
-		m_edges.emplace(Edge{_user, sendTo, safe->tokenAddress, l});
 		// Edge from the user/token pair to the receiver, restricted by send limit.
-		m_flowGraph[make_pair(_user, safe->tokenAddress)][sendTo] = l;
+		_arcs.emplace_back(make_tuple(_user, safe->tokenAddress), sendTo, l);
 	}
 
 	// Edges that send tokens back to their owner.
@@ -124,79 +241,91 @@ void DB::computeEdgesFrom(Address const& _user)
 			if (Token const* token = tokenMaybe(tokenAddress))
 				if (_user != token->safeAddress)
 				{
-					m_edges.emplace(Edge{_user, token->safeAddress, tokenAddress, balance});
-					m_flowGraph[_user][make_pair(_user, tokenAddress)] = balance;
-					m_flowGraph[make_pair(_user, tokenAddress)][token->safeAddress] = balance;
+					_arcs.emplace_back(_user, make_tuple(_user, tokenAddress), balance);
+					_arcs.emplace_back(make_tuple(_user, tokenAddress), token->safeAddress, balance);
 				}
 
 	//log_trace("<- DB::computeEdgesFrom(_user: '%s')", to_string(_user).c_str());
 }
 
-void DB::computeEdgesTo(Address const& _sendTo)
+void DB::computeEdgesTo(AddressId _sendTo)
 {
 	Safe const* receiverSafe = safeMaybe(_sendTo);
 	if (!receiverSafe)
 		return;
-	Address const& tokenAddress = receiverSafe->tokenAddress;
+	AddressId tokenAddress = receiverSafe->tokenAddress;
 
-	for (auto const& [sender, safe]: safes)
+	// Edges along trust connections.
+	for (AddressId sender: senders(_sendTo))
 	{
 		if (sender == _sendTo)
 			continue;
-
-		// Edges along trust connections.
-		if (safe.limitPercentage.count(sender))
+		Safe const& senderSafe = safe(sender);
+		Int l = limit(sender, _sendTo);
+		if (l != Int(0))
 		{
-			Int l = limit(sender, _sendTo);
-			if (l == Int(0))
-				continue;
-			m_edges.emplace(Edge{sender, _sendTo, safe.tokenAddress, l});
-			m_flowGraph[sender][make_pair(sender, safe.tokenAddress)] = safe.balance(safe.tokenAddress);
-			m_flowGraph[make_pair(sender, safe.tokenAddress)][_sendTo] = l;
+			setTokenCapacity(sender, senderSafe.tokenAddress, senderSafe.balance(senderSafe.tokenAddress));
+			setEdge(sender, _sendTo, senderSafe.tokenAddress, l);
 		}
-		// Edges that send tokens back to their owner.
-		Int balance = safe.balance(tokenAddress);
-		if (balance != Int{} && tokenAddress != Address{})
+	}
+
+	// Edges that send tokens back to their owner.
+	if (tokenAddress != AddressTable::Zero)
+		for (AddressId sender: holders(tokenAddress))
 		{
-			m_edges.emplace(Edge{sender, _sendTo, tokenAddress, balance});
-			m_flowGraph[sender][make_pair(sender, tokenAddress)] = balance;
-			m_flowGraph[make_pair(sender, tokenAddress)][_sendTo] = balance;
+			if (sender == _sendTo)
+				continue;
+			Int balance = safe(sender).balance(tokenAddress);
+			setTokenCapacity(sender, tokenAddress, balance);
+			setEdge(sender, _sendTo, tokenAddress, balance);
 		}
-	}
 }
 
 void DB::signup(Address const& _user, Address const& _token)
 {
 	cerr << "Signup: " << _user << " with token " << _token << endl;
+	AddressId user = addressTable().intern(_user);
+	AddressId token = addressTable().intern(_token);
 	// TODO balances empty at start?
-	if (!safeMaybe(_user))
-		safes[_user] = Safe{_token, {}, {}, false};
-	if (!tokenMaybe(_token))
-		tokens[_token] = Token{_token, _user};
+	if (!safeMaybe(user))
+		safes[user] = Safe{token, {}, {}, false};
+	if (!tokenMaybe(token))
+		tokens[token] = Token{token, user};
 }
 
 void DB::organizationSignup(Address const& _organization)
 {
 	cerr << "Organization signup: " << _organization << endl;
-	if (!safeMaybe(_organization))
-		safes[_organization] = Safe{{}, {}, {}, true};
+	AddressId organization = addressTable().intern(_organization);
+	if (!safeMaybe(organization))
+		safes[organization] = Safe{AddressTable::Zero, {}, {}, true};
 }
 
 void DB::trust(Address const& _canSendTo, Address const& _user, uint32_t _limitPercentage)
 {
 	cerr << "Trust change: " << _user << " send to " << _canSendTo << ": " << _limitPercentage << "%" << endl;
 	require(_limitPercentage <= 100);
+	AddressId canSendTo = addressTable().intern(_canSendTo);
+	AddressId user = addressTable().intern(_user);
 
-	if (Safe* safe = safeMaybe(_user))
+	if (Safe* safe = safeMaybe(user))
 	{
 		if (_limitPercentage == 0)
-			safe->limitPercentage.erase(_canSendTo);
+		{
+			safe->limitPercentage.erase(canSendTo);
+			auto it = m_senders.find(canSendTo);
+			if (it != m_senders.end() && it->second.erase(user) && it->second.empty())
+				m_senders.erase(it);
+		}
 		else
-			safe->limitPercentage[_canSendTo] = _limitPercentage;
+		{
+			safe->limitPercentage[canSendTo] = _limitPercentage;
+			m_senders[canSendTo].insert(user);
+		}
 
-		updateEdgesFrom(_user);
-		// TODO actually only this edge:
-		//updateEdges(_user, _canSendTo, safe->tokenAddress);
+		m_dirtyTrustEdges.emplace(user, canSendTo);
+		if (!m_delayEdgeUpdates)
+			updateDirtyEdges();
 	}
 	else
 		cerr << "Unknown safe." << endl;
@@ -214,7 +343,10 @@ void DB::transfer(
 	cerr << "Transfer: " << _value << ": " << _from << " -> " << _to << " [" << _token << "]" << endl;
 	// This is a generic ERC20 event and might be unrelated to the
 	// Circles system.
-	Token* token = tokenMaybe(_token);
+	AddressId tokenAddress = addressTable().intern(_token);
+	AddressId from = addressTable().intern(_from);
+	AddressId to = addressTable().intern(_to);
+	Token* token = tokenMaybe(tokenAddress);
 	if (!token || _value == Int{})
 	{
 		if (!token)
@@ -223,91 +355,222 @@ void DB::transfer(
 	}
 
 	Safe* senderSafe = nullptr;
-	if (_from == Address{})
-		require(_to == token->safeAddress);
+	if (from == AddressTable::Zero)
+		require(to == token->safeAddress);
 	else
 	{
-		senderSafe = safeMaybe(_from);
+		senderSafe = safeMaybe(from);
 		if (!senderSafe)
 		{
 			cerr << "Unknown sender safe." << endl;
 			return;
 		}
 		// Regular transfer
-		require(senderSafe->balances[_token] >= _value);
-		senderSafe->balances[_token] -= _value;
+		require(senderSafe->balances[tokenAddress] >= _value);
+		senderSafe->balances[tokenAddress] -= _value;
+		if (senderSafe->balances[tokenAddress] == Int(0))
+		{
+			auto it = m_holders.find(tokenAddress);
+			if (it != m_holders.end() && it->second.erase(from) && it->second.empty())
+				m_holders.erase(it);
+		}
 	}
 
-	Safe* receiverSafe = safeMaybe(_to);
+	Safe* receiverSafe = safeMaybe(to);
 	if (receiverSafe)
-		receiverSafe->balances[_token] += _value;
+	{
+		receiverSafe->balances[tokenAddress] += _value;
+		m_holders[tokenAddress].insert(to);
+	}
 	else
 		cerr << "Unknown receiver safe." << endl;
 
-	if (_from == Address{})
+	// Only the balances in this token changed (for a mint, only that of the receiver).
+	if (from != AddressTable::Zero)
+		m_dirtyBalances.emplace(from, tokenAddress);
+	m_dirtyBalances.emplace(to, tokenAddress);
+	if (!m_delayEdgeUpdates)
+		updateDirtyEdges();
+	cerr << "Update following transfer complete." << endl;
+}
+
+void DB::applyEvents(vector<Event> const& _events)
+{
+	log_debug("-> DB::applyEvents(_events: %li)", _events.size());
+	bool delayed = m_delayEdgeUpdates;
+	m_delayEdgeUpdates = true;
+	try
 	{
-		// Token minted.
-		updateEdgesTo(_to);
-		updateEdgesFrom(_to);
+		for (Event const& event: _events)
+			apply(event);
 	}
-	else
+	catch (...)
 	{
-		// TODO actually only the token
-		// TODO really all of them?
-		updateEdgesFrom(_from);
-		updateEdgesFrom(_to);
-		updateEdgesTo(_from);
-		updateEdgesTo(_to);
+		// The events before the failing one stay applied, so their edges have to be updated.
+		m_delayEdgeUpdates = delayed;
+		if (!m_delayEdgeUpdates)
+			updateDirtyEdges();
+		throw;
 	}
-	cerr << "Update following transfer complete." << endl;
+	m_delayEdgeUpdates = delayed;
+	if (!m_delayEdgeUpdates)
+		updateDirtyEdges();
+	log_debug("<- DB::applyEvents(_events: %li)", _events.size());
 }
 
-void DB::updateEdgesFrom(Address const& _from)
+void DB::apply(Event const& _event)
 {
-	if (m_delayEdgeUpdates)
+	switch (_event.type)
+	{
+	case Event::Type::Signup:
+		signup(_event.user, _event.token);
+		break;
+	case Event::Type::OrganizationSignup:
+		organizationSignup(_event.user);
+		break;
+	case Event::Type::Trust:
+		trust(_event.canSendTo, _event.user, _event.limitPercentage);
+		break;
+	case Event::Type::Transfer:
+		transfer(_event.token, _event.from, _event.to, _event.value);
+		break;
+	}
+}
+
+void DB::updateDirtyEdges()
+{
+	if (m_dirtyTrustEdges.empty() && m_dirtyBalances.empty())
 		return;
 
-	cerr << "Updating edges from " << _from << endl;
+	// Once a large part of the graph is affected, rebuilding it in bulk is cheaper.
+	if (m_dirtyTrustEdges.size() + m_dirtyBalances.size() > safes.size())
+	{
+		m_dirtyTrustEdges.clear();
+		m_dirtyBalances.clear();
+		computeEdges();
+		return;
+	}
 
-	// TODO this loop can be optimized because of the sort order.
-	for (auto it = m_edges.begin(); it != m_edges.end();)
-		if (it->from == _from)
-			it = m_edges.erase(it);
-		else
-			++it;
+	set<pair<AddressId, AddressId>> trustEdges;
+	swap(trustEdges, m_dirtyTrustEdges);
+	for (auto const& [user, token]: m_dirtyBalances)
+		updateBalanceArcs(user, token, trustEdges);
+	m_dirtyBalances.clear();
+	updateTrustEdges(vector<pair<AddressId, AddressId>>(trustEdges.begin(), trustEdges.end()));
+}
 
-	m_flowGraph.erase(_from);
-	cerr << "erasing pseudo-edges..." <<endl;
-	m_flowGraph.erase(
-		m_flowGraph.lower_bound(make_pair(_from, Address{})),
-		m_flowGraph.upper_bound(make_pair(_from, Address{"0xffffffffffffffffffffffffffffffffffffffff"s}))
-	);
-	cerr << "done" << endl;
+void DB::updateBalanceArcs(AddressId _user, AddressId _token, set<pair<AddressId, AddressId>>& _trustEdges)
+{
+	Safe const* safe = safeMaybe(_user);
+	Token const* token = tokenMaybe(_token);
+	if (!safe || !token)
+		return;
+	Int balance = safe->balance(_token);
+
+	if (_token == safe->tokenAddress)
+	{
+		// The own balance limits the edge to the own token,
+		// all outgoing trust edges...
+		if (_token != AddressTable::Zero)
+			setTokenCapacity(_user, _token, balance);
+		for (auto const& trust: safe->limitPercentage)
+			_trustEdges.emplace(_user, trust.first);
+		// ...and all incoming ones.
+		for (AddressId sender: senders(_user))
+			_trustEdges.emplace(sender, _user);
+	}
+
+	if (_user != token->safeAddress)
+	{
+		// The edge that sends the token back to its owner.
+		setTokenCapacity(_user, _token, balance);
+		setEdge(_user, token->safeAddress, _token, balance);
+		// The limit of the owner's edge to the user takes what the user already holds into account.
+		if (Safe const* ownerSafe = safeMaybe(token->safeAddress))
+			if (ownerSafe->tokenAddress == _token)
+				_trustEdges.emplace(token->safeAddress, _user);
+	}
+}
+
+void DB::updateTrustEdges(vector<pair<AddressId, AddressId>> const& _trustEdges)
+{
+	// Computing the limits only reads the safes, so it can be split up.
+	vector<Int> limits(_trustEdges.size());
+	parallelFor(_trustEdges.size(), threadCount(), [&](size_t _begin, size_t _end) {
+		for (size_t i = _begin; i < _end; i++)
+			limits[i] = limit(_trustEdges[i].first, _trustEdges[i].second);
+	});
+
+	for (size_t i = 0; i < _trustEdges.size(); i++)
+	{
+		auto const& [from, to] = _trustEdges[i];
+		if (from != to)
+			if (Safe const* safe = safeMaybe(from))
+				setEdge(from, to, safe->tokenAddress, limits[i]);
+	}
+}
+
+void DB::updateEdgesFrom(AddressId _from)
+{
+	cerr << "Updating edges from " << address(_from) << endl;
+
+	// Collect the edges and token arcs of _from first, the view
+	// is invalidated by the changes.
+	vector<pair<AddressId, AddressId>> edges;
+	vector<AddressId> tokens;
+	FlowGraphView graph = m_flowGraph.view();
+	NodeId from = graph.nodeId(_from);
+	if (from != NoNode)
+		for (ArcId arc = graph.begin(from); arc < graph.end(from); arc++)
+		{
+			NodeId pseudo = graph.targets[arc];
+			auto const* pseudoNode = get_if<tuple<AddressId, AddressId>>(&graph.nodes[pseudo]);
+			if (!pseudoNode || get<0>(*pseudoNode) != _from)
+				continue;
+			AddressId token = get<1>(*pseudoNode);
+			tokens.push_back(token);
+			for (ArcId edge = graph.begin(pseudo); edge < graph.end(pseudo); edge++)
+				if (graph.capacities[edge] != Int(0))
+					edges.emplace_back(get<AddressId>(graph.nodes[graph.targets[edge]]), token);
+		}
+	for (auto const& [to, token]: edges)
+		setEdge(_from, to, token, {});
+	for (AddressId token: tokens)
+		setTokenCapacity(_from, token, {});
 
 	computeEdgesFrom(_from);
 
 	cerr << "Done." << endl;
 }
 
-void DB::updateEdgesTo(Address const& _to)
+void DB::updateEdgesTo(AddressId _to)
 {
-	if (m_delayEdgeUpdates)
-		return;
-
-	cerr << "Updating edges to " << _to << endl;
-	for (auto it = m_edges.begin(); it != m_edges.end();)
-		if (it->to == _to)
-			it = m_edges.erase(it);
-		else
-			++it;
-	cerr << "erasing pseudo-edges..." <<endl;
-	// TODO this does not leave the graph in a clean state, but
-	// it is probably enough.
-	for (auto& [node, targets]: m_flowGraph)
-		targets.erase(_to);
-	cerr << "done" << endl;
+	cerr << "Updating edges to " << address(_to) << endl;
+
+	// The edges into _to are the reverse arcs of _to that lead to pseudo-nodes.
+	vector<pair<AddressId, AddressId>> edges;
+	FlowGraphView graph = m_flowGraph.view();
+	NodeId to = graph.nodeId(_to);
+	if (to != NoNode)
+		for (ArcId arc = graph.begin(to); arc < graph.end(to); arc++)
+			if (auto const* pseudoNode = get_if<tuple<AddressId, AddressId>>(&graph.nodes[graph.targets[arc]]))
+				if (graph.capacities[graph.reverse[arc]] != Int(0))
+					edges.emplace_back(get<0>(*pseudoNode), get<1>(*pseudoNode));
+	for (auto const& [from, token]: edges)
+		setEdge(from, _to, token, {});
 
 	computeEdgesTo(_to);
 
 	cerr << "Done." << endl;
 }
+
+GraphVersion::GraphVersion(DB const& _db):
+	graph(_db.flowGraph()),
+	generation(_db.generation()),
+	edgeCount(_db.edgeCount())
+{
+	if (!_db.tokens.empty())
+		tokenOwners.resize(_db.tokens.rbegin()->first + 1, AddressTable::Zero);
+	for (auto const& [address, token]: _db.tokens)
+		tokenOwners[address] = token.safeAddress;
+}
@@ -1,66 +1,125 @@
 #pragma once
 
 #include "types.h"
+#include "flowGraph.h"
 
 struct Token
 {
-	Address address;
-	Address safeAddress;
+	AddressId address;
+	AddressId safeAddress;
 
 	bool operator<(Token const& _other) const { return address < _other.address; }
 };
 
 struct Safe
 {
-	Address tokenAddress;
+	AddressId tokenAddress;
 	/// token address to balance
-	std::map<Address, Int> balances;
+	std::map<AddressId, Int> balances;
 	/// Limit percentage in "send to" direction.
-	std::map<Address, uint32_t> limitPercentage;
+	std::map<AddressId, uint32_t> limitPercentage;
 	bool organization{false};
 
-	Int balance(Address const& _token) const;
-	uint32_t sendToPercentage(Address const& _sendToUser) const;
+	Int balance(AddressId _token) const;
+	uint32_t sendToPercentage(AddressId _sendToUser) const;
 };
 
-struct DB
+/// A change to the Circles system as delivered by the indexer,
+/// see the DB functions of the same name.
+struct Event
 {
-	std::map<Address, Safe> safes;
-	std::map<Address, Token> tokens;
-	/// Trust edges.
-	std::set<Edge> m_edges;
+	enum class Type { Signup, OrganizationSignup, Trust, Transfer };
+	Type type;
+	/// Signup, trust: the user; organization signup: the organization.
+	Address user;
+	/// Signup, transfer: the token.
+	Address token;
+	/// Trust
+	Address canSendTo;
+	uint32_t limitPercentage = 0;
+	/// Transfer
+	Address from;
+	Address to;
+	Int value;
+};
 
-	/// Adjacency list of the flow graph.
-	/// The trust graph is a multi-graph, but this one introduces
-	/// one node on each edge of the trust graph.
-	std::map<FlowGraphNode, std::map<FlowGraphNode, Int>> m_flowGraph;
+/// The state of the Circles system, with all addresses
+/// interned in the global AddressTable.
+struct DB
+{
+	std::map<AddressId, Safe> safes;
+	std::map<AddressId, Token> tokens;
+	/// Flow graph of the trust edges, the only representation of the edges.
+	/// It is patched whenever an edge changes.
+	/// The trust graph is a multi-graph, so an edge from A to B in token T is
+	/// an arc from the pseudo-node (A, T) to B, and the arc from A to (A, T)
+	/// is limited by the balance of A in T.
+	FlowGraph m_flowGraph;
+	/// Number of edges with non-zero capacity.
+	size_t m_edgeCount = 0;
+	/// Incremented on every change to the edges.
+	uint64_t m_generation = 0;
+
+	/// Reverse trust index: address to the safes that have it in their limitPercentage.
+	std::map<AddressId, std::set<AddressId>> m_senders;
+	/// Token address to the safes with a non-zero balance of it.
+	std::map<AddressId, std::set<AddressId>> m_holders;
 
 	bool m_delayEdgeUpdates = false;
+	/// Trust edges (from, to) and balances (user, token) that changed
+	/// since the edges were last updated.
+	std::set<std::pair<AddressId, AddressId>> m_dirtyTrustEdges;
+	std::set<std::pair<AddressId, AddressId>> m_dirtyBalances;
 
-	Safe const& safe(Address const& _address) const;
-	Safe* safeMaybe(Address const& _address)
+	Safe const& safe(AddressId _address) const;
+	Safe* safeMaybe(AddressId _address)
 	{
 		auto it = safes.find(_address);
 		return it == safes.end() ? nullptr : &it->second;
 	}
-	Safe const* safeMaybe(Address const& _address) const
+	Safe const* safeMaybe(AddressId _address) const
 	{
 		auto it = safes.find(_address);
 		return it == safes.end() ? nullptr : &it->second;
 	}
 
-	Token const& token(Address const& _address) const;
-	Token const* tokenMaybe(Address const& _address) const;
-	Token* tokenMaybe(Address const& _address);
+	Token const& token(AddressId _address) const;
+	Token const* tokenMaybe(AddressId _address) const;
+	Token* tokenMaybe(AddressId _address);
 
 	/// @returns how much of @a _user's token they can send to @a _canSendTo.
-	Int limit(Address const& _user, Address const& _canSendTo) const;
+	Int limit(AddressId _user, AddressId _canSendTo) const;
 
+	/// @returns the safes that can send their tokens to @a _sendTo (subject to limits).
+	std::set<AddressId> const& senders(AddressId _sendTo) const;
+	/// @returns the safes that hold some of @a _token.
+	std::set<AddressId> const& holders(AddressId _token) const;
+	/// Recomputes m_senders and m_holders from the safes.
+	void computeIndices();
+
+	/// Recomputes all edges and rebuilds the flow graph in bulk, using threadCount() threads.
 	void computeEdges();
-	void computeEdgesFrom(Address const& _user);
-	void computeEdgesTo(Address const& _user);
-	std::set<Edge> const& edges() const { return m_edges; }
-	std::map<FlowGraphNode, std::map<FlowGraphNode, Int>> const& flowGraph() const { return m_flowGraph; }
+	/// Replaces the flow graph by @a _graph, which has to match the safes
+	/// (e.g. because it was stored in a snapshot together with them).
+	void setFlowGraph(FlowGraph _graph);
+	void computeEdgesFrom(AddressId _user);
+	/// Appends the arcs of all edges from @a _user (and the arcs into its pseudo-nodes)
+	/// with non-zero capacity to @a _arcs. Only reads the DB.
+	void computeEdgesFrom(AddressId _user, std::vector<FlowGraphArc>& _arcs) const;
+	void computeEdgesTo(AddressId _user);
+	/// @returns all edges with non-zero capacity, sorted. They are derived from the flow graph.
+	std::vector<Edge> edges() const;
+	size_t edgeCount() const { return m_edgeCount; }
+	FlowGraph const& flowGraph() const { return m_flowGraph; }
+	uint64_t generation() const { return m_generation; }
+
+	/// Sets the capacity of the edge from @a _from to @a _to in @a _token.
+	void setEdge(AddressId _from, AddressId _to, AddressId _token, Int const& _capacity);
+	/// Sets the capacity of the arc from @a _user to its pseudo-node for @a _token,
+	/// i.e. how much of @a _token @a _user can send in total.
+	void setTokenCapacity(AddressId _user, AddressId _token, Int const& _capacity);
+	/// Sets an arc as produced by computeEdgesFrom() through setEdge() or setTokenCapacity().
+	void setArc(FlowGraphArc const& _arc);
 
 	void updateLimit(DB const& _db, Connection& _connection);
 
@@ -69,9 +128,44 @@ struct DB
 	void trust(Address const& _canSendTo, Address const& _user, uint32_t _limitPercentage);
 	void transfer(Address const& _token, Address const& _from, Address const& _to, Int const& _value);
 
-	void updateEdgesFrom(Address const& _from);
-	void updateEdgesTo(Address const& _to);
+	/// Applies all events and updates the affected edges once at the end
+	/// (or with the next performEdgeUpdates() if updates are delayed).
+	/// If an event throws, the events before it stay applied and their edges are updated.
+	void applyEvents(std::vector<Event> const& _events);
+	void apply(Event const& _event);
+
+	/// Updates the edges affected by the changes recorded in m_dirtyTrustEdges
+	/// and m_dirtyBalances.
+	void updateDirtyEdges();
+	/// Patches the arcs that directly carry the balance of @a _user in @a _token and
+	/// adds the trust edges whose limit depends on that balance to @a _trustEdges.
+	void updateBalanceArcs(AddressId _user, AddressId _token, std::set<std::pair<AddressId, AddressId>>& _trustEdges);
+	/// Recomputes the limits of the trust edges (from, to) and patches them.
+	void updateTrustEdges(std::vector<std::pair<AddressId, AddressId>> const& _trustEdges);
+
+	/// Erases and recomputes all edges from @a _from.
+	void updateEdgesFrom(AddressId _from);
+	/// Erases and recomputes all edges to @a _to.
+	void updateEdgesTo(AddressId _to);
 
 	void delayEdgeUpdates() { m_delayEdgeUpdates = true; }
-	void performEdgeUpdates() { m_delayEdgeUpdates = false; computeEdges(); }
+	void performEdgeUpdates() { m_delayEdgeUpdates = false; updateDirtyEdges(); }
+	/// @returns true if some changes are not yet reflected in the flow graph.
+	bool hasPendingEdgeUpdates() const { return !m_dirtyTrustEdges.empty() || !m_dirtyBalances.empty(); }
+};
+
+/// Immutable copy of the flow graph of a DB at one generation, which
+/// flow queries can keep using while the DB is modified further.
+/// Versions are shared via std::shared_ptr, so a version lives as long
+/// as the last query that uses it.
+struct GraphVersion
+{
+	explicit GraphVersion(DB const& _db);
+
+	FrozenFlowGraph graph;
+	/// Token address to the safe that issued it (Zero if unknown).
+	std::vector<AddressId> tokenOwners;
+	/// DB::generation() at the time of the copy.
+	uint64_t generation;
+	size_t edgeCount;
 };
@@ -2,9 +2,31 @@
 
 #include "exceptions.h"
 
+#include <cstdint>
 #include <variant>
 #include <iostream>
 
+/// Magic bytes at the start of a versioned snapshot file ("PFDB").
+/// Files without them are in the original format (version 1), which
+/// starts with the block number.
+static constexpr uint8_t SnapshotMagic[4] = {'P', 'F', 'D', 'B'};
+static constexpr uint32_t SnapshotVersion = 2;
+
+/// Magic bytes at the start of a file in the compact encoding ("PFDC"),
+/// which stores the same data as version 1 but uses varints and deltas.
+static constexpr uint8_t CompactMagic[4] = {'P', 'F', 'D', 'C'};
+
+/// Sections of a versioned snapshot file.
+enum class SnapshotSection: uint32_t
+{
+	/// The addresses, encoded as in version 1.
+	Addresses = 1,
+	/// The safes, encoded as in version 1.
+	Safes = 2,
+	/// The flow graph of the safes as a compacted FlowGraph (optional).
+	FlowGraph = 3
+};
+
 template <size_t _bytes>
 struct BigEndian
 {
@@ -29,6 +51,42 @@ struct BigEndian
 	}
 };
 
+/// Decodes the @a _bytes bytes at @a _data as a big-endian integer.
+template <size_t _bytes>
+uint64_t fromBigEndian(uint8_t const* _data)
+{
+	uint64_t v = 0;
+	for (size_t i = 0; i < _bytes; ++i)
+		v = (v << 8) | _data[i];
+	return v;
+}
+
+/// Decodes the @a _bytes bytes at @a _data as a little-endian integer.
+template <size_t _bytes>
+uint64_t fromLittleEndian(uint8_t const* _data)
+{
+	uint64_t v = 0;
+	for (size_t i = 0; i < _bytes; ++i)
+		v |= uint64_t(_data[i]) << (i * 8);
+	return v;
+}
+
+/// Writes @a _value as a little-endian integer of @a _bytes bytes.
+template <size_t _bytes>
+void writeLittleEndian(std::ostream& _os, uint64_t _value)
+{
+	for (size_t i = 0; i < _bytes; ++i)
+		_os.put(char((_value >> (i * 8)) & 0xff));
+}
+
+/// Writes @a _value as unsigned LEB128, i.e. seven bits per byte, least significant first.
+inline void writeVarint(std::ostream& _os, uint64_t _value)
+{
+	for (; _value >= 0x80; _value >>= 7)
+		_os.put(char((_value & 0x7f) | 0x80));
+	_os.put(char(_value));
+}
+
 inline uint8_t fromHex(char _c)
 {
 	if ('0' <= _c && _c <= '9')
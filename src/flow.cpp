@@ -1,6 +1,12 @@
 #include "flow.h"
 
-#include <queue>
+#include "parallel.h"
+#include "reachability.h"
+
+#include <atomic>
+#include <exception>
+#include <mutex>
+#include <vector>
 #include <variant>
 #include <functional>
 #include "log.h"
@@ -9,237 +15,670 @@ using namespace std;
 
 using Node = FlowGraphNode;
 
-Node pseudoNode(Edge const& _edge)
+/// Atomic, since it can be changed while queries run.
+static atomic<FlowAlgorithm> _flowAlgorithm{FlowAlgorithm::EdmondsKarp};
+
+void setFlowAlgorithm(FlowAlgorithm _algorithm)
 {
-	return make_tuple(_edge.from, _edge.token);
+	_flowAlgorithm = _algorithm;
 }
 
-/// Concatenate the contents of a container onto a vector, move variant.
-template <class T, class U> vector<T>& operator+=(vector<T>& _a, U&& _b)
+FlowAlgorithm flowAlgorithm()
 {
-	std::move(_b.begin(), _b.end(), std::back_inserter(_a));
-	return _a;
+	return _flowAlgorithm;
 }
 
-template <class K, class V, class F>
-void erase_if(map<K, V>& _container, F const& _fun)
+/// Range of topological positions (see ReachabilityIndex) of the nodes that can
+/// lie on an augmenting path from a source to a sink.
+/// The nodes outside of it cannot be reached from the source or cannot reach
+/// the sink, also not via reverse arcs once flow has been pushed (those only
+/// lead back along paths from the source to the sink). So leaving them out
+/// does not change which paths the searches find.
+struct SearchRange
 {
-    log_debug("-> erase_if(_container: %li, _fun: F)", _container.size());
-
-	for (auto it = _container.begin(); it != _container.end();)
-		 if (_fun(*it))
-			it = _container.erase(it);
-		 else
-			++it;
+	SearchRange(FlowGraphView const& _graph, NodeId _source, NodeId _sink):
+		index(_graph.reachability)
+	{
+		if (index)
+		{
+			first = index->order(_source);
+			last = index->order(_sink);
+		}
+	}
 
-    log_debug("<- erase_if(_container: %li, _fun: F)", _container.size());
-}
+	bool contains(NodeId _node) const
+	{
+		if (!index)
+			return true;
+		uint32_t order = index->order(_node);
+		return first <= order && order <= last;
+	}
 
-static map<Node, map<Node, Int>> _adjacencies;
-static bool _adjacenciesDirty = true;
+	ReachabilityIndex const* index = nullptr;
+	uint32_t first = 0;
+	uint32_t last = 0;
+};
 
-/// Turns the edge set into an adjacency list.
-/// At the same time, it generates new pseudo-nodes to cope with the multi-edges.
-map<Node, map<Node, Int>> computeAdjacencies(set<Edge> const& _edges)
+/// Memory of the breadth-first searches for augmenting paths. There is one per
+/// thread, so concurrent queries (e.g. on the workers of the JSON mode) do not
+/// share it and consecutive searches do not allocate.
+struct SearchScratch
 {
-    log_debug("-> computeAdjacencies(_edges: %li)", _edges.size());
-
-    if (!_adjacenciesDirty) {
-        log_debug("<- computeAdjacencies(_edges: %li) - cached", _edges.size());
-        return _adjacencies;
-    }
-
-    _adjacencies = map<Node, map<Node, Int>>();
+	/// A node is visited in the current search iff its entry equals `stamp`.
+	vector<uint32_t> visited;
+	uint32_t stamp = 0;
+	/// The arc that was used to reach each visited node.
+	vector<ArcId> parent;
+	/// The nodes in the order they were reached, with the flow that reaches them.
+	vector<pair<NodeId, Int>> queue;
+
+	/// Prepares a new search on a graph with @a _nodeCount nodes.
+	void start(size_t _nodeCount)
+	{
+		if (visited.size() < _nodeCount)
+		{
+			visited.resize(_nodeCount, 0);
+			parent.resize(_nodeCount, NoArc);
+		}
+		if (++stamp == 0)
+		{
+			fill(visited.begin(), visited.end(), 0);
+			stamp = 1;
+		}
+		queue.clear();
+	}
+};
+
+thread_local SearchScratch searchScratch;
+
+/// Finds a shortest augmenting path from @a _source to @a _sink in the residual graph.
+/// Neighbours are visited by decreasing residual capacity.
+/// @returns the flow along the path. For each node on the path, the arc
+/// that was used to reach it is stored in `_scratch.parent`.
+Int augmentingPath(
+	NodeId _source,
+	NodeId _sink,
+	SearchRange const& _range,
+	ResidualGraph& _residual,
+	SearchScratch& _scratch
+)
+{
+	FlowGraphView const& graph = _residual.graph();
+	_scratch.start(graph.nodeCount);
+	_scratch.visited[_source] = _scratch.stamp;
+	_scratch.queue.emplace_back(_source, Int::max());
 
-	for (Edge const& edge: _edges)
+	for (size_t head = 0; head < _scratch.queue.size(); head++)
 	{
-        auto pseudo = pseudoNode(edge);
-		// One edge from "from" to "from x token" with a capacity as the max over
-		// all contributing edges (the balance of the sender)
-        _adjacencies[edge.from][pseudo] = max(edge.capacity, _adjacencies[edge.from][pseudo]);
-		// Another edge from "from x token" to "to" with its own capacity (based on the trust)
-        _adjacencies[pseudo][edge.to] = edge.capacity;
+		NodeId node = _scratch.queue[head].first;
+		ArcId const* arcs = _residual.byCapacity(node);
+		for (ArcId i = 0; i < graph.end(node) - graph.begin(node); i++)
+		{
+			ArcId arc = arcs[i];
+			Int const& capacity = _residual.residual(node, arc);
+			// All further arcs are saturated.
+			if (capacity == Int(0))
+				break;
+			NodeId target = graph.targets[arc];
+			if (_scratch.visited[target] != _scratch.stamp && _range.contains(target))
+			{
+				_scratch.visited[target] = _scratch.stamp;
+				_scratch.parent[target] = arc;
+				// The queue may grow, so do not keep a reference into it.
+				Int newFlow = min(_scratch.queue[head].second, capacity);
+				if (target == _sink)
+					return newFlow;
+				_scratch.queue.emplace_back(target, move(newFlow));
+			}
+		}
 	}
+	return Int(0);
+}
 
-	log_debug("<- computeAdjacencies(_edges: %li)", _edges.size());
-    _adjacenciesDirty = false;
-	return _adjacencies;
+Int edmondsKarp(
+	NodeId _source,
+	NodeId _sink,
+	SearchRange const& _range,
+	Int const& _requestedFlow,
+	ResidualGraph& _residual
+)
+{
+	FlowGraphView const& graph = _residual.graph();
+	SearchScratch& scratch = searchScratch;
+	Int flow{0};
+	while (flow < _requestedFlow)
+	{
+		Int newFlow = augmentingPath(_source, _sink, _range, _residual, scratch);
+		if (newFlow == Int(0))
+			break;
+		if (flow + newFlow > _requestedFlow)
+			newFlow = _requestedFlow - flow;
+		flow += newFlow;
+		for (NodeId node = _sink; node != _source; )
+		{
+			ArcId arc = scratch.parent[node];
+			node = graph.targets[graph.reverse[arc]];
+			_residual.push(node, arc, newFlow);
+		}
+	}
+	return flow;
 }
 
-vector<pair<Node, Int>> sortedByCapacity(map<Node, Int> const& _capacities)
+/// Computes the BFS level of each node reachable from @a _source in the residual graph,
+/// using @a _queue as the queue.
+/// @returns false if @a _sink is not reachable.
+bool levelGraph(
+	NodeId _source,
+	NodeId _sink,
+	SearchRange const& _range,
+	ResidualGraph const& _residual,
+	ArenaVector<uint32_t>& _level,
+	ArenaVector<NodeId>& _queue
+)
 {
-    log_debug("-> sortedByCapacity(_capacities: %li)", _capacities.size());
-	vector<pair<Node, Int>> r(_capacities.begin(), _capacities.end());
-	sort(r.begin(), r.end(), [](pair<Node, Int> const& _a, pair<Node, Int> const& _b) {
-		return make_pair(get<1>(_a), get<0>(_a)) > make_pair(get<1>(_b), get<0>(_b));
-	});
-    log_debug("<- sortedByCapacity(_capacities: %li)", _capacities.size());
-	return r;
+	FlowGraphView const& graph = _residual.graph();
+	static constexpr uint32_t unreached = uint32_t(-1);
+	fill(_level.begin(), _level.end(), unreached);
+	_level[_source] = 0;
+	_queue.assign(1, _source);
+	for (size_t head = 0; head < _queue.size(); head++)
+	{
+		NodeId node = _queue[head];
+		// Nodes beyond the level of the sink cannot be part of a shortest path.
+		if (_level[_sink] != unreached && _level[node] >= _level[_sink])
+			break;
+		for (ArcId arc = graph.begin(node); arc < graph.end(node); arc++)
+		{
+			NodeId target = graph.targets[arc];
+			if (_level[target] == unreached && _range.contains(target) && Int(0) < _residual.residual(node, arc))
+			{
+				_level[target] = _level[node] + 1;
+				_queue.push_back(target);
+			}
+		}
+	}
+	return _level[_sink] != unreached;
 }
 
-pair<Int, map<Node, Node>> augmentingPath(
-	Address const& _source,
-	Address const& _sink,
-	map<Node, map<Node, Int>> const& _capacity
+Int dinic(
+	NodeId _source,
+	NodeId _sink,
+	SearchRange const& _range,
+	Int const& _requestedFlow,
+	ResidualGraph& _residual
 )
 {
-	if (_source == _sink || !_capacity.count(_source))
-		return {Int(0), {}};
+	FlowGraphView const& graph = _residual.graph();
+	Arena& arena = _residual.arena();
+	ArenaVector<uint32_t> level(graph.nodeCount, arena);
+	/// Next arc to try for each node in the current blocking flow phase.
+	ArenaVector<ArcId> currentArc(graph.nodeCount, arena);
+	/// Arcs of the path from the source to the current node.
+	ArenaVector<ArcId> path(arena);
+	ArenaVector<NodeId> queue(arena);
 
-	map<Node, Node> parent;
-	queue<pair<Node, Int>> q;
-	q.emplace(_source, Int::max());
+	auto tail = [&](ArcId _arc) { return graph.targets[graph.reverse[_arc]]; };
 
-	while (!q.empty())
+	Int flow{0};
+	while (flow < _requestedFlow && levelGraph(_source, _sink, _range, _residual, level, queue))
 	{
-		//cout << "Queue size: " << q.size() << endl;
-		//cout << "Parent relation size: " << parent.size() << endl;
-		auto [node, flow] = q.front();
-		q.pop();
-		if (!_capacity.count(node))
-			continue;
-		for (auto const& [target, capacity]: sortedByCapacity(_capacity.at(node)))
-			if (!parent.count(target) && Int(0) < capacity)
+		for (NodeId node = 0; node < graph.nodeCount; node++)
+			currentArc[node] = graph.begin(node);
+		path.clear();
+		NodeId node = _source;
+		while (flow < _requestedFlow)
+		{
+			if (node == _sink)
+			{
+				Int newFlow = _requestedFlow - flow;
+				for (ArcId arc: path)
+					newFlow = min(newFlow, _residual.residual(tail(arc), arc));
+				flow += newFlow;
+				// Push the flow and retreat to the tail of the first saturated arc.
+				size_t saturated = path.size();
+				for (size_t i = 0; i < path.size(); i++)
+				{
+					NodeId from = tail(path[i]);
+					_residual.push(from, path[i], newFlow);
+					if (saturated == path.size() && _residual.residual(from, path[i]) == Int(0))
+						saturated = i;
+				}
+				path.resize(saturated);
+				node = path.empty() ? _source : graph.targets[path.back()];
+				continue;
+			}
+			ArcId& arc = currentArc[node];
+			for (; arc < graph.end(node); arc++)
+			{
+				NodeId target = graph.targets[arc];
+				if (level[target] == level[node] + 1 && Int(0) < _residual.residual(node, arc))
+					break;
+			}
+			if (arc < graph.end(node))
 			{
-				parent[target] = node;
-				Int newFlow = min(flow, capacity);
-				if (target == Node{_sink})
-					return make_pair(move(newFlow), move(parent));
-				q.emplace(target, move(newFlow));
+				path.push_back(arc);
+				node = graph.targets[arc];
 			}
+			else
+			{
+				// Dead end, no blocking flow passes through this node any more.
+				if (node == _source)
+					break;
+				level[node] = uint32_t(-1);
+				path.pop_back();
+				node = path.empty() ? _source : graph.targets[path.back()];
+				currentArc[node]++;
+			}
+		}
 	}
-	return {Int(0), {}};
+	return flow;
 }
 
-/// Extract the next list of transfers until we get to a situation where
-/// we cannot transfer the full balance and start over.
-vector<Edge> extractNextTransfers(map<Node, map<Node, Int>>& _usedEdges, map<Address, Int>& _nodeBalances)
+/// Runs the selected flow algorithm on @a _residual.
+Int maxFlow(
+	NodeId _source,
+	NodeId _sink,
+	Int const& _requestedFlow,
+	ResidualGraph& _residual
+)
 {
-    auto initialEdgesSize = _usedEdges.size();
-    auto initialNodesSize = _nodeBalances.size();
-    log_debug("-> extractNextTransfers(_usedEdges: %li, _nodeBalances: %li)", initialEdgesSize, initialNodesSize);
-	vector<Edge> transfers;
+	SearchRange range(_residual.graph(), _source, _sink);
+	return
+		_flowAlgorithm == FlowAlgorithm::Dinic ?
+		dinic(_source, _sink, range, _requestedFlow, _residual) :
+		edmondsKarp(_source, _sink, range, _requestedFlow, _residual);
+}
+
+/// Turns the flow in @a _residual into transfers, ordered such that every
+/// sender already holds the amount it sends: The flow along the arcs out of
+/// pseudo-nodes, i.e. along the trust edges, is decomposed in topological order
+/// of the senders, starting at @a _source. Cycles in the flow are cancelled
+/// first, which does not change the amount that arrives at @a _sink.
+/// Each transfer is passed to @a _onTransfer as soon as its sender is done.
+/// Linear in the size of the flow, plus the total length of the cancelled cycles.
+void extractTransfers(ResidualGraph const& _residual, NodeId _source, Int const& _amount, TransferCallback const& _onTransfer)
+{
+	log_debug("-> extractTransfers(_amount: %s)", to_string(_amount).c_str());
+
+	FlowGraphView const& graph = _residual.graph();
+	Arena& arena = _residual.arena();
+
+	/// Flow along a trust edge, between local indices of the nodes.
+	struct FlowEdge
+	{
+		uint32_t from;
+		uint32_t to;
+		AddressId token;
+		Int amount;
+	};
+	ArenaVector<FlowEdge> edges(arena);
+	/// Local index to node id, the source comes first.
+	ArenaVector<NodeId> nodes({_source}, arena);
+	ArenaMap<NodeId, uint32_t> localIndex({{_source, 0}}, 0, hash<NodeId>{}, equal_to<NodeId>{}, arena);
+	auto local = [&](NodeId _node) {
+		auto [it, inserted] = localIndex.emplace(_node, uint32_t(nodes.size()));
+		if (inserted)
+			nodes.push_back(_node);
+		return it->second;
+	};
+	for (NodeId node: _residual.touchedNodes())
+	{
+		auto const* pseudo = get_if<tuple<AddressId, AddressId>>(&graph.nodes[node]);
+		if (!pseudo)
+			continue;
+		auto const& [from, token] = *pseudo;
+		for (ArcId arc = graph.begin(node); arc < graph.end(node); arc++)
+			if (Int flow = _residual.flow(node, arc); flow != Int(0))
+				edges.push_back(FlowEdge{
+					local(graph.nodeId(from)),
+					local(graph.targets[arc]),
+					token,
+					move(flow)
+				});
+	}
+
+	// Adjacency lists in both directions, by edge index.
+	size_t nodeCount = nodes.size();
+	ArenaVector<uint32_t> outBegin(nodeCount + 1, 0, arena);
+	ArenaVector<uint32_t> inBegin(nodeCount + 1, 0, arena);
+	for (FlowEdge const& edge: edges)
+	{
+		outBegin[edge.from + 1]++;
+		inBegin[edge.to + 1]++;
+	}
+	for (size_t i = 0; i < nodeCount; i++)
+	{
+		outBegin[i + 1] += outBegin[i];
+		inBegin[i + 1] += inBegin[i];
+	}
+	ArenaVector<uint32_t> outEdges(edges.size(), arena);
+	ArenaVector<uint32_t> inEdges(edges.size(), arena);
+	{
+		ArenaVector<uint32_t> outPos(outBegin.begin(), outBegin.end() - 1, arena);
+		ArenaVector<uint32_t> inPos(inBegin.begin(), inBegin.end() - 1, arena);
+		for (uint32_t i = 0; i < edges.size(); i++)
+		{
+			outEdges[outPos[edges[i].from]++] = i;
+			inEdges[inPos[edges[i].to]++] = i;
+		}
+	}
 
-	for (auto& [node, balance]: _nodeBalances)
-		for (auto& edge: _usedEdges[node])
+	/// Number of incoming edges with flow from nodes that did not send yet.
+	ArenaVector<uint32_t> pending(nodeCount, 0, arena);
+	for (FlowEdge const& edge: edges)
+		pending[edge.to]++;
+	ArenaVector<bool> done(nodeCount, false, arena);
+	ArenaVector<uint32_t> ready(arena);
+	for (uint32_t node = 0; node < nodeCount; node++)
+		if (pending[node] == 0)
+			ready.push_back(node);
+
+	/// Position in the incoming edges of each node before which all edges are irrelevant
+	/// for finding cycles, i.e. have no flow left or come from nodes that already sent.
+	ArenaVector<uint32_t> inNext(inBegin.begin(), inBegin.end() - 1, arena);
+	/// Step at which a node was visited in the current search for a cycle, or zero.
+	ArenaVector<uint32_t> visitStep(nodeCount, 0, arena);
+	auto removeEdge = [&](uint32_t _edge) {
+		if (--pending[edges[_edge].to] == 0)
+			ready.push_back(edges[_edge].to);
+	};
+
+	size_t doneCount = 0;
+	uint32_t searchFrom = 0;
+	/// Edges followed backwards while searching for a cycle.
+	ArenaVector<uint32_t> path(arena);
+	while (doneCount < nodeCount)
+	{
+		if (ready.empty())
 		{
-			Node const& intermediate = edge.first;
-			for (auto& [toNode, capacity]: _usedEdges[intermediate])
+			// All remaining nodes wait for one another, so following incoming
+			// edges backwards from any of them runs into a cycle. The search
+			// continues the path of the previous one, without the nodes at its
+			// end that sent meanwhile. A node that did not send still waits for
+			// the one after it, so the ones before it did not send either.
+			while (!path.empty() && done[edges[path.back()].from])
 			{
-				auto const& [from, token] = std::get<tuple<Address, Address>>(intermediate);
-				Address to = std::get<Address>(toNode);
-				if (capacity == Int(0))
-					continue;
-				if (balance < capacity)
-				{
-					// We do not have enough balance yet, there will be another transfer along this edge.
-					if (!transfers.empty())
-						return transfers;
-					else
-						continue;
-				}
-				transfers.push_back(Edge{from, to, token, capacity});
-				balance -= capacity;
-				_nodeBalances[to] += capacity;
-				capacity = Int(0);
+				visitStep[edges[path.back()].from] = 0;
+				path.pop_back();
+			}
+			if (path.empty())
+			{
+				visitStep[searchFrom] = 0;
+				while (done[searchFrom])
+					searchFrom++;
 			}
+			uint32_t node = path.empty() ? searchFrom : edges[path.back()].from;
+			visitStep[node] = 0;
+			for (uint32_t step = uint32_t(path.size()) + 1; visitStep[node] == 0; step++)
+			{
+				visitStep[node] = step;
+				uint32_t& next = inNext[node];
+				while (edges[inEdges[next]].amount == Int(0) || done[edges[inEdges[next]].from])
+					next++;
+				path.push_back(inEdges[next]);
+				node = edges[inEdges[next]].from;
+			}
+			// The cycle consists of the edges after the one into `node`,
+			// the path up to `node` is kept for the next search.
+			size_t cycleStart = visitStep[node] - 1;
+			Int amount = edges[path[cycleStart]].amount;
+			for (size_t i = cycleStart; i < path.size(); i++)
+				amount = min(amount, edges[path[i]].amount);
+			for (size_t i = cycleStart; i < path.size(); i++)
+			{
+				edges[path[i]].amount -= amount;
+				if (edges[path[i]].amount == Int(0))
+					removeEdge(path[i]);
+			}
+			for (size_t i = cycleStart + 1; i < path.size(); i++)
+				visitStep[edges[path[i]].to] = 0;
+			path.resize(cycleStart);
+			continue;
 		}
 
-    log_debug("   extractNextTransfers(_usedEdges: %li, _nodeBalances: %li): '_usedEdges' size: %li, '_nodeBalances' size: %li", initialEdgesSize, initialNodesSize, _usedEdges.size(), _nodeBalances.size());
-	erase_if(_nodeBalances, [](auto& _a) { return _a.second == Int(0); });
-    log_debug("   extractNextTransfers(_usedEdges: %li, _nodeBalances: %li): '_usedEdges' size: %li, '_nodeBalances' size: %li", initialEdgesSize, initialNodesSize, _usedEdges.size(), _nodeBalances.size());
-    log_debug("<- extractNextTransfers(_usedEdges: %li, _nodeBalances: %li)", initialEdgesSize, initialNodesSize);
-	return transfers;
+		uint32_t node = ready.back();
+		ready.pop_back();
+		done[node] = true;
+		doneCount++;
+		for (uint32_t i = outBegin[node]; i < outBegin[node + 1]; i++)
+		{
+			FlowEdge const& edge = edges[outEdges[i]];
+			if (edge.amount == Int(0))
+				continue;
+			_onTransfer(Edge{
+				get<AddressId>(graph.nodes[nodes[node]]),
+				get<AddressId>(graph.nodes[nodes[edge.to]]),
+				edge.token,
+				edge.amount
+			});
+			removeEdge(outEdges[i]);
+		}
+	}
+
+	log_debug("<- extractTransfers(_amount: %s)", to_string(_amount).c_str());
 }
 
+pair<Int, vector<Edge>> computeFlow(
+	AddressId _source,
+	AddressId _sink,
+	FlowGraphView const& _graph,
+	Int _requestedFlow
+)
+{
+	vector<Edge> transfers;
+	Int flow = computeFlow(
+		_source,
+		_sink,
+		_graph,
+		_requestedFlow,
+		[](Int const&) {},
+		[&](Edge const& _transfer) { transfers.push_back(_transfer); }
+	);
+	return {move(flow), move(transfers)};
+}
 
-vector<Edge> extractTransfers(Address const& _source, Address const& _sink, Int _amount, map<Node, map<Node, Int>> _usedEdges)
+Int computeFlow(
+	AddressId _source,
+	AddressId _sink,
+	FlowGraphView const& _graph,
+	Int const& _requestedFlow,
+	function<void(Int const&)> const& _onFlow,
+	TransferCallback const& _onTransfer
+)
 {
-    auto initialEdgesSize = _usedEdges.size();
-    log_debug("-> extractTransfers(_source: '%s', _sink: '%s', _amount: %s, _usedEdges: %li, _nodeBalances: %li)",
-              to_string(_source).c_str(),
-              to_string(_sink).c_str(),
-              to_string(_amount).c_str(),
-              initialEdgesSize);
+    log_debug("-> computeFlow(_source: '%s', _sink: '%s', _nodes: %li, _requestedFlow: %s)",
+              to_string(address(_source)).c_str(),
+              to_string(address(_sink)).c_str(),
+              _graph.nodeCount,
+              to_string(_requestedFlow).c_str());
 
-	vector<Edge> transfers;
+	NodeId source = _graph.nodeId(_source);
+	NodeId sink = _graph.nodeId(_sink);
+	if (
+		source == sink || source == NoNode || sink == NoNode ||
+		(_graph.reachability && !_graph.reachability->reachable(source, sink))
+	)
+	{
+		_onFlow(Int(0));
+		return Int(0);
+	}
 
-	map<Address, Int> nodeBalances;
-	nodeBalances[_source] = _amount;
-	while (
-		!nodeBalances.empty() &&
-		(nodeBalances.size() > 1 || nodeBalances.begin()->first != _sink)
-	) {
-        transfers += extractNextTransfers(_usedEdges, nodeBalances);
-    }
+	ArenaScope scope(Arena::forThread(), true);
+	ResidualGraph residual(_graph);
+	Int flow = maxFlow(source, sink, _requestedFlow, residual);
+	_onFlow(flow);
 
-    log_debug("<- extractTransfers(_source: '%s', _sink: '%s', _amount: %s, _usedEdges: %li, _nodeBalances: %li)",
-              to_string(_source).c_str(),
-              to_string(_sink).c_str(),
-              to_string(_amount).c_str(),
-              initialEdgesSize);
+    log_debug("<- computeFlow(_source: '%s', _sink: '%s', _nodes: %li, _requestedFlow: %s)",
+              to_string(address(_source)).c_str(),
+              to_string(address(_sink)).c_str(),
+              _graph.nodeCount,
+              to_string(_requestedFlow).c_str());
+
+	if (flow != Int(0))
+		extractTransfers(residual, source, flow, _onTransfer);
+	return flow;
+}
+
+Int computeMaxFlow(
+	AddressId _source,
+	AddressId _sink,
+	FlowGraphView const& _graph,
+	Int const& _requestedFlow
+)
+{
+	NodeId source = _graph.nodeId(_source);
+	NodeId sink = _graph.nodeId(_sink);
+	if (source == sink || source == NoNode || sink == NoNode)
+		return Int(0);
+	if (_graph.reachability && !_graph.reachability->reachable(source, sink))
+		return Int(0);
+	ArenaScope scope(Arena::forThread(), true);
+	ResidualGraph residual(_graph);
+	return maxFlow(source, sink, _requestedFlow, residual);
+}
 
-    return transfers;
+Int minCut(NodeId _source, NodeId _sink, ResidualGraph& _residual, vector<bool>& _sourceSide)
+{
+	FlowGraphView const& graph = _residual.graph();
+	Int flow = dinic(_source, _sink, SearchRange(graph, _source, _sink), Int::max(), _residual);
+
+	// The source side is everything still reachable in the residual graph.
+	_sourceSide.assign(graph.nodeCount, false);
+	_sourceSide[_source] = true;
+	ArenaVector<NodeId> queue({_source}, _residual.arena());
+	for (size_t head = 0; head < queue.size(); head++)
+	{
+		NodeId node = queue[head];
+		for (ArcId arc = graph.begin(node); arc < graph.end(node); arc++)
+		{
+			NodeId target = graph.targets[arc];
+			if (!_sourceSide[target] && Int(0) < _residual.residual(node, arc))
+			{
+				_sourceSide[target] = true;
+				queue.push_back(target);
+			}
+		}
+	}
+	return flow;
 }
 
 pair<Int, vector<Edge>> computeFlow(
-	Address const& _source,
-	Address const& _sink,
-	set<Edge> const& _edges,
+	AddressId _source,
+	AddressId _sink,
+	FlowGraph const& _graph,
 	Int _requestedFlow
 )
 {
-    log_debug("-> computeFlow(_source: '%s', _sink: '%s', _edges: %li, _requestedFlow: %s)",
-              to_string(_source).c_str(),
-              to_string(_sink).c_str(),
-              _edges.size(),
-              to_string(_requestedFlow).c_str());
+	return computeFlow(_source, _sink, _graph.view(), move(_requestedFlow));
+}
 
-	map<Node, map<Node, Int>> adjacencies = computeAdjacencies(_edges);
-	map<Node, map<Node, Int>> capacities = adjacencies;
+vector<pair<Int, vector<Edge>>> computeFlows(
+	vector<FlowQuery> const& _queries,
+	FlowGraphView const& _graph,
+	size_t _threads
+)
+{
+	log_debug("-> computeFlows(_queries: %li, _threads: %li)", _queries.size(), _threads);
+
+	vector<pair<Int, vector<Edge>>> results(_queries.size());
+	// Queries differ a lot in cost, so each thread takes the next one when it is done.
+	atomic<size_t> next{0};
+	exception_ptr error;
+	mutex errorMutex;
+	parallelFor(_threads, _threads, [&](size_t, size_t) {
+		for (size_t i = next++; i < _queries.size(); i = next++)
+			try
+			{
+				results[i] = computeFlow(_queries[i].source, _queries[i].sink, _graph, _queries[i].requestedFlow);
+			}
+			catch (...)
+			{
+				lock_guard<mutex> lock(errorMutex);
+				if (!error)
+					error = current_exception();
+			}
+	}, 1);
+	if (error)
+		rethrow_exception(error);
 
-    log_debug("   computeFlow(_source: '%s', _sink: '%s', _edges: %li, _requestedFlow: %s): %li nodes (including pseudo-nodes) and %li adjacencies from %li edges",
-              to_string(_source).c_str(),
-              to_string(_sink).c_str(),
-              _edges.size(),
-              to_string(_requestedFlow).c_str(),
-              capacities.size(),
-              adjacencies.size(),
-              _edges.size());
+	log_debug("<- computeFlows(_queries: %li, _threads: %li)", _queries.size(), _threads);
+	return results;
+}
 
-	map<Node, map<Node, Int>> usedEdges;
+FlowsFromSource::FlowsFromSource(AddressId _source, FlowGraphView const& _graph):
+	m_graph(_graph),
+	m_source(_graph.nodeId(_source)),
+	m_residual(_graph, m_arena)
+{
+	log_debug("-> FlowsFromSource(_source: '%s')", to_string(address(_source)).c_str());
 
-	Int flow{0};
-	while (flow < _requestedFlow)
+	// Everything a flow from the source can reach, no flow from the source
+	// ever creates residual capacity leading out of this set.
+	m_reachable.assign(m_graph.nodeCount, false);
+	if (m_source != NoNode)
 	{
-		auto [newFlow, parents] = augmentingPath(_source, _sink, capacities);
-		//cout << "Found augmenting path with flow " << newFlow << endl;
-		if (newFlow == Int(0))
-			break;
-		if (flow + newFlow > _requestedFlow)
-			newFlow = _requestedFlow - flow;
-		flow += newFlow;
-		for (Node node = _sink; node != Node{_source}; )
+		ArenaVector<NodeId> queue({m_source}, m_arena);
+		m_reachable[m_source] = true;
+		for (size_t head = 0; head < queue.size(); head++)
 		{
-			Node const& prev = parents[node];
-			capacities[prev][node] -= newFlow;
-			capacities[node][prev] += newFlow;
-			// TODO still not sure about this one.
-			if (!adjacencies.count(node) || !adjacencies.at(node).count(prev) || adjacencies.at(node).at(prev) == Int(0))
-				// real edge
-				usedEdges[prev][node] += newFlow;
-			else
-				// (partial) edge removal
-				usedEdges[node][prev] -= newFlow;
-			node = prev;
+			NodeId node = queue[head];
+			for (ArcId arc = m_graph.begin(node); arc < m_graph.end(node); arc++)
+			{
+				NodeId target = m_graph.targets[arc];
+				if (!m_reachable[target] && Int(0) < m_graph.capacities[arc])
+				{
+					m_reachable[target] = true;
+					queue.push_back(target);
+				}
+			}
 		}
 	}
 
-    log_debug("<- computeFlow(_source: '%s', _sink: '%s', _edges: %li, _requestedFlow: %s)",
-              to_string(_source).c_str(),
-              to_string(_sink).c_str(),
-              _edges.size(),
-              to_string(_requestedFlow).c_str());
+	log_debug("<- FlowsFromSource(_source: '%s')", to_string(address(_source)).c_str());
+}
+
+FlowsFromSource::~FlowsFromSource()
+{
+	recordArenaQuery(m_arena.peak());
+}
+
+Int FlowsFromSource::flowTo(AddressId _sink, Int const& _requestedFlow)
+{
+	m_residual.reset();
+	m_sink = m_graph.nodeId(_sink);
+	m_flow = Int(0);
+	if (m_source != NoNode && m_sink != NoNode && m_source != m_sink && m_reachable[m_sink])
+		m_flow = maxFlow(m_source, m_sink, _requestedFlow, m_residual);
+	return m_flow;
+}
+
+vector<Edge> FlowsFromSource::transfers() const
+{
+	vector<Edge> result;
+	transfers([&](Edge const& _transfer) { result.push_back(_transfer); });
+	return result;
+}
+
+void FlowsFromSource::transfers(TransferCallback const& _onTransfer) const
+{
+	if (m_flow != Int(0))
+		extractTransfers(m_residual, m_source, m_flow, _onTransfer);
+}
+
+vector<Int> computeFlowsFrom(
+	AddressId _source,
+	vector<pair<AddressId, Int>> const& _sinks,
+	FlowGraphView const& _graph
+)
+{
+	log_debug("-> computeFlowsFrom(_source: '%s', _sinks: %li)", to_string(address(_source)).c_str(), _sinks.size());
+
+	FlowsFromSource flows(_source, _graph);
+	vector<Int> results;
+	results.reserve(_sinks.size());
+	for (auto const& [sink, requestedFlow]: _sinks)
+		results.push_back(flows.flowTo(sink, requestedFlow));
 
-	return {flow, extractTransfers(_source, _sink, flow, usedEdges)};
+	log_debug("<- computeFlowsFrom(_source: '%s', _sinks: %li)", to_string(address(_source)).c_str(), _sinks.size());
+	return results;
 }
@@ -1,10 +1,127 @@
 #pragma once
 
 #include "types.h"
+#include "flowGraph.h"
 
+#include <functional>
+
+/// Max-flow engine used by computeFlow.
+enum class FlowAlgorithm
+{
+	/// One shortest augmenting path per breadth-first search. This is the reference engine.
+	EdmondsKarp,
+	/// Level graph plus blocking flow along all shortest paths per phase.
+	Dinic
+};
+
+void setFlowAlgorithm(FlowAlgorithm _algorithm);
+FlowAlgorithm flowAlgorithm();
+
+/// Computes the max flow (up to @a _requestedFlow) from @a _source to @a _sink
+/// and the transfers that realize it.
+/// The graph is only read, all query state is kept in a residual overlay.
 std::pair<Int, std::vector<Edge>> computeFlow(
-	Address const& _source,
-	Address const& _sink,
-	std::set<Edge> const& _edges,
+	AddressId _source,
+	AddressId _sink,
+	FlowGraphView const& _graph,
 	Int _requestedFlow = Int::max()
 );
+
+/// Receives the transfers of a flow one at a time, see extractTransfers().
+using TransferCallback = std::function<void(Edge const&)>;
+
+/// Streaming variant of computeFlow(): Calls @a _onFlow with the value of the flow
+/// as soon as it is known and then @a _onTransfer with each transfer as soon as
+/// it is extracted, in the same order as above, so the transfers never have to
+/// be held at once.
+/// @returns the value of the flow.
+Int computeFlow(
+	AddressId _source,
+	AddressId _sink,
+	FlowGraphView const& _graph,
+	Int const& _requestedFlow,
+	std::function<void(Int const&)> const& _onFlow,
+	TransferCallback const& _onTransfer
+);
+
+/// @returns the max flow (up to @a _requestedFlow) from @a _source to @a _sink
+/// without extracting the transfers, which is cheaper if only the value is needed.
+Int computeMaxFlow(
+	AddressId _source,
+	AddressId _sink,
+	FlowGraphView const& _graph,
+	Int const& _requestedFlow = Int::max()
+);
+
+/// Computes a minimum cut between @a _source and @a _sink using the flow
+/// overlay @a _residual, which has to be free of flow, and sets
+/// `_sourceSide[n]` for the nodes `n` on the side of @a _source (resizing it
+/// to the number of nodes).
+/// @returns the capacity of the cut, i.e. the max flow.
+Int minCut(NodeId _source, NodeId _sink, ResidualGraph& _residual, std::vector<bool>& _sourceSide);
+
+/// Convenience overload that queries the current state of @a _graph, e.g. DB::flowGraph().
+std::pair<Int, std::vector<Edge>> computeFlow(
+	AddressId _source,
+	AddressId _sink,
+	FlowGraph const& _graph,
+	Int _requestedFlow = Int::max()
+);
+
+/// One of the queries of computeFlows().
+struct FlowQuery
+{
+	AddressId source;
+	AddressId sink;
+	Int requestedFlow = Int::max();
+};
+
+/// Computes the flows of all @a _queries on @a _graph, distributing them over
+/// @a _threads threads, each query with its own residual overlay.
+/// @returns the results of computeFlow() in the order of @a _queries.
+std::vector<std::pair<Int, std::vector<Edge>>> computeFlows(
+	std::vector<FlowQuery> const& _queries,
+	FlowGraphView const& _graph,
+	size_t _threads
+);
+
+/// Max flows from one source to many sinks on the same graph, one at a time.
+///
+/// Compared to separate computeFlow() calls, the nodes reachable from the
+/// source are only determined once, which answers unreachable sinks right
+/// away, and the residual overlay and search buffers are reused.
+/// Transfers are only extracted on request.
+class FlowsFromSource
+{
+public:
+	/// The graph has to stay valid and unchanged while the object is used.
+	FlowsFromSource(AddressId _source, FlowGraphView const& _graph);
+	/// Counts all flows as one query in arenaStatistics().
+	~FlowsFromSource();
+
+	/// @returns the max flow (up to @a _requestedFlow) from the source to @a _sink.
+	Int flowTo(AddressId _sink, Int const& _requestedFlow = Int::max());
+	/// @returns the transfers that realize the flow of the last call to flowTo().
+	std::vector<Edge> transfers() const;
+	/// Passes the transfers that realize the flow of the last call to flowTo()
+	/// to @a _onTransfer one at a time.
+	void transfers(TransferCallback const& _onTransfer) const;
+
+private:
+	FlowGraphView m_graph;
+	NodeId m_source = NoNode;
+	std::vector<bool> m_reachable;
+	/// Scratch memory of the queries, released by the reset of m_residual before each of them.
+	Arena m_arena;
+	ResidualGraph m_residual;
+	NodeId m_sink = NoNode;
+	Int m_flow;
+};
+
+/// @returns the max flow from @a _source to each of @a _sinks (up to the flow
+/// requested for it), in the order of @a _sinks. See FlowsFromSource.
+std::vector<Int> computeFlowsFrom(
+	AddressId _source,
+	std::vector<std::pair<AddressId, Int>> const& _sinks,
+	FlowGraphView const& _graph
+);
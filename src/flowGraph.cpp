@@ -0,0 +1,503 @@
+#include "flowGraph.h"
+
+#include "exceptions.h"
+#include "log.h"
+#include "parallel.h"
+#include "reachability.h"
+
+#include <algorithm>
+#include <numeric>
+#include <tuple>
+
+using namespace std;
+
+bool FlowGraphView::capacityBefore(Int const& _capacityA, NodeId _targetA, Int const& _capacityB, NodeId _targetB) const
+{
+	if (_capacityA != _capacityB)
+		return _capacityA > _capacityB;
+	return nodeLess(nodes[_targetB], nodes[_targetA]);
+}
+
+void FlowGraphView::sortByCapacity(NodeId _node, Int const* _capacities, ArcId* _order) const
+{
+	ArcId first = begin(_node);
+	sort(_order, _order + (end(_node) - first), [&](ArcId _a, ArcId _b) {
+		return capacityBefore(_capacities[_a - first], targets[_a], _capacities[_b - first], targets[_b]);
+	});
+}
+
+size_t FlowGraphView::edgeCount() const
+{
+	size_t count = 0;
+	for (NodeId node = 0; node < nodeCount; node++)
+		if (holds_alternative<tuple<AddressId, AddressId>>(nodes[node]))
+			for (ArcId arc = begin(node); arc < end(node); arc++)
+				if (capacities[arc] != Int(0))
+					count++;
+	return count;
+}
+
+void FlowGraphView::validate(size_t _arcCount) const
+{
+	for (NodeId node = 0; node < nodeCount; node++)
+	{
+		ArcId first = begin(node);
+		ArcId last = end(node);
+		require(first <= last && last <= _arcCount);
+		for (ArcId arc = first; arc < last; arc++)
+		{
+			require(targets[arc] < nodeCount);
+			// Residual graphs index the reverse arc relative to the arcs of its target.
+			require(begin(targets[arc]) <= reverse[arc] && reverse[arc] < end(targets[arc]) && end(targets[arc]) <= _arcCount);
+			require(reverse[reverse[arc]] == arc && targets[reverse[arc]] == node);
+			require(first <= byCapacity[arc] && byCapacity[arc] < last);
+		}
+	}
+}
+
+bool FlowGraphView::nodeLess(FlowGraphNode const& _a, FlowGraphNode const& _b)
+{
+	if (_a.index() != _b.index())
+		return _a.index() < _b.index();
+	if (auto const* a = get_if<AddressId>(&_a))
+		return address(*a) < address(get<AddressId>(_b));
+	auto const& [aFrom, aToken] = get<1>(_a);
+	auto const& [bFrom, bToken] = get<1>(_b);
+	return tie(address(aFrom), address(aToken)) < tie(address(bFrom), address(bToken));
+}
+
+FlowGraph FlowGraph::fromArcs(vector<FlowGraphArc> const& _arcs)
+{
+	log_debug("-> FlowGraph::fromArcs(_arcs: %li)", _arcs.size());
+
+	FlowGraph graph;
+	vector<FlowGraphNode>& nodes = graph.m_nodes;
+	// Number the nodes by address, this keeps the arcs of related nodes close.
+	// The endpoints are sorted by their index, which is cheaper than moving the variants.
+	vector<size_t> endpoints(2 * _arcs.size());
+	iota(endpoints.begin(), endpoints.end(), 0);
+	auto endpoint = [&](size_t _index) -> FlowGraphNode const& {
+		return _index % 2 ? get<1>(_arcs[_index / 2]) : get<0>(_arcs[_index / 2]);
+	};
+	sort(endpoints.begin(), endpoints.end(), [&](size_t _a, size_t _b) {
+		return FlowGraphView::nodeLess(endpoint(_a), endpoint(_b));
+	});
+	for (size_t index: endpoints)
+		if (nodes.empty() || nodes.back() != endpoint(index))
+			nodes.push_back(endpoint(index));
+	require(nodes.size() < NoNode);
+	for (NodeId id = 0; id < nodes.size(); id++)
+		if (auto const* address = get_if<AddressId>(&nodes[id]))
+		{
+			if (graph.m_addressNodes.size() <= *address)
+				graph.m_addressNodes.resize(*address + 1, NoNode);
+			graph.m_addressNodes[*address] = id;
+		}
+		else
+		{
+			auto const& [from, token] = get<1>(nodes[id]);
+			graph.m_pseudoNodes[pseudoKey(from, token)] = id;
+		}
+
+	// All arcs including the reverse arcs, as (from, to, capacity).
+	vector<tuple<NodeId, NodeId, Int>> arcs;
+	arcs.reserve(2 * _arcs.size());
+	for (auto const& [from, to, capacity]: _arcs)
+	{
+		NodeId fromId = graph.nodeId(from);
+		NodeId toId = graph.nodeId(to);
+		arcs.emplace_back(fromId, toId, capacity);
+		arcs.emplace_back(toId, fromId, Int(0));
+	}
+	// Sort by (from, to) and, among duplicates, by decreasing capacity,
+	// so that keeping the first of each run yields the maximum.
+	sort(arcs.begin(), arcs.end(), [](auto const& _a, auto const& _b) {
+		return
+			make_tuple(get<0>(_a), get<1>(_a), get<2>(_b)) <
+			make_tuple(get<0>(_b), get<1>(_b), get<2>(_a));
+	});
+	arcs.erase(unique(arcs.begin(), arcs.end(), [](auto const& _a, auto const& _b) {
+		return get<0>(_a) == get<0>(_b) && get<1>(_a) == get<1>(_b);
+	}), arcs.end());
+	require(arcs.size() < NoArc);
+
+	graph.m_arcBegin.assign(nodes.size(), 0);
+	graph.m_arcEnd.assign(nodes.size(), 0);
+	graph.m_targets.reserve(arcs.size());
+	graph.m_capacities.reserve(arcs.size());
+	for (auto const& [from, to, capacity]: arcs)
+	{
+		graph.m_arcEnd[from]++;
+		graph.m_targets.push_back(to);
+		graph.m_capacities.push_back(capacity);
+	}
+	for (NodeId node = 0; node < nodes.size(); node++)
+	{
+		graph.m_arcBegin[node] = node == 0 ? 0 : graph.m_arcEnd[node - 1];
+		graph.m_arcEnd[node] += graph.m_arcBegin[node];
+	}
+	graph.m_arcLimit = graph.m_arcEnd;
+	graph.m_arcCount = arcs.size();
+
+	// The remaining work is independent per node.
+	graph.m_reverse.resize(arcs.size());
+	graph.m_byCapacity.resize(arcs.size());
+	FlowGraphView view = graph.view();
+	parallelFor(nodes.size(), threadCount(), [&](size_t _begin, size_t _end) {
+		for (NodeId node = NodeId(_begin); node < _end; node++)
+		{
+			for (ArcId arc = graph.m_arcBegin[node]; arc < graph.m_arcEnd[node]; arc++)
+			{
+				// Every arc was added together with its reverse, so this always finds it.
+				NodeId target = graph.m_targets[arc];
+				auto targetsEnd = graph.m_targets.begin() + graph.m_arcEnd[target];
+				auto it = lower_bound(graph.m_targets.begin() + graph.m_arcBegin[target], targetsEnd, node);
+				graph.m_reverse[arc] = ArcId(it - graph.m_targets.begin());
+				graph.m_byCapacity[arc] = arc;
+			}
+			view.sortByCapacity(node, &graph.m_capacities[graph.m_arcBegin[node]], &graph.m_byCapacity[graph.m_arcBegin[node]]);
+		}
+	});
+
+	log_debug("<- FlowGraph::fromArcs(_arcs: %li)", _arcs.size());
+	return graph;
+}
+
+FlowGraph FlowGraph::fromArrays(
+	vector<FlowGraphNode> _nodes,
+	vector<ArcId> const& _offsets,
+	vector<NodeId> _targets,
+	vector<Int> _capacities,
+	vector<ArcId> _reverse,
+	vector<ArcId> _byCapacity
+)
+{
+	size_t arcCount = _targets.size();
+	require(_nodes.size() < NoNode && arcCount < NoArc);
+	require(_offsets.size() == _nodes.size() + 1 && _offsets.front() == 0 && _offsets.back() == arcCount);
+	require(_capacities.size() == arcCount && _reverse.size() == arcCount && _byCapacity.size() == arcCount);
+
+	FlowGraph graph;
+	for (FlowGraphNode const& node: _nodes)
+		require(graph.addNode(node) == graph.m_nodes.size() - 1);
+	for (NodeId node = 0; node < _nodes.size(); node++)
+	{
+		graph.m_arcBegin[node] = _offsets[node];
+		graph.m_arcEnd[node] = _offsets[node + 1];
+	}
+	graph.m_arcLimit = graph.m_arcEnd;
+	graph.m_targets = move(_targets);
+	graph.m_capacities = move(_capacities);
+	graph.m_reverse = move(_reverse);
+	graph.m_byCapacity = move(_byCapacity);
+	graph.m_arcCount = arcCount;
+	graph.view().validate(arcCount);
+	return graph;
+}
+
+FlowGraphView FlowGraph::view() const
+{
+	FlowGraphView view;
+	view.nodeCount = m_nodes.size();
+	view.nodes = m_nodes.data();
+	view.arcBegin = m_arcBegin.data();
+	view.arcEnd = m_arcEnd.data();
+	view.targets = m_targets.data();
+	view.capacities = m_capacities.data();
+	view.reverse = m_reverse.data();
+	view.byCapacity = m_byCapacity.data();
+	view.addressNodes = m_addressNodes.data();
+	view.addressCount = m_addressNodes.size();
+	return view;
+}
+
+FrozenFlowGraph::FrozenFlowGraph(FlowGraph const& _graph):
+	m_nodes(_graph.m_nodes),
+	m_addressNodes(_graph.m_addressNodes),
+	m_arcBegin(_graph.m_arcBegin),
+	m_arcEnd(_graph.m_arcEnd),
+	m_targets(_graph.m_targets),
+	m_capacities(_graph.m_capacities),
+	m_reverse(_graph.m_reverse),
+	m_byCapacity(_graph.m_byCapacity),
+	m_view(_graph.view())
+{
+	m_view.nodes = m_nodes.data();
+	m_view.arcBegin = m_arcBegin.data();
+	m_view.arcEnd = m_arcEnd.data();
+	m_view.targets = m_targets.data();
+	m_view.capacities = m_capacities.data();
+	m_view.reverse = m_reverse.data();
+	m_view.byCapacity = m_byCapacity.data();
+	m_view.addressNodes = m_addressNodes.data();
+	m_reachability = make_unique<ReachabilityIndex const>(m_view);
+	m_view.reachability = m_reachability.get();
+}
+
+FrozenFlowGraph::~FrozenFlowGraph() = default;
+
+NodeId FlowGraph::nodeId(FlowGraphNode const& _node) const
+{
+	if (auto const* address = get_if<AddressId>(&_node))
+		return *address < m_addressNodes.size() ? m_addressNodes[*address] : NoNode;
+	auto const& [from, token] = get<1>(_node);
+	auto it = m_pseudoNodes.find(pseudoKey(from, token));
+	return it == m_pseudoNodes.end() ? NoNode : it->second;
+}
+
+Int FlowGraph::capacity(FlowGraphNode const& _from, FlowGraphNode const& _to) const
+{
+	NodeId from = nodeId(_from);
+	NodeId to = nodeId(_to);
+	if (from == NoNode || to == NoNode)
+		return {};
+	ArcId arc = findArc(from, to);
+	return arc == NoArc ? Int{} : m_capacities[arc];
+}
+
+Int FlowGraph::setCapacity(FlowGraphNode const& _from, FlowGraphNode const& _to, Int const& _capacity)
+{
+	NodeId from = nodeId(_from);
+	NodeId to = nodeId(_to);
+	ArcId arc = from == NoNode || to == NoNode ? NoArc : findArc(from, to);
+	if (arc == NoArc)
+	{
+		if (_capacity == Int(0))
+			return {};
+		from = addNode(_from);
+		to = addNode(_to);
+
+		if (m_holes > 1024 && m_holes > m_targets.size() / 2)
+			compact();
+		reserveArc(from);
+		reserveArc(to);
+		arc = m_arcEnd[from]++;
+		ArcId reverseArc = m_arcEnd[to]++;
+		m_targets[arc] = to;
+		m_targets[reverseArc] = from;
+		m_capacities[arc] = Int(0);
+		m_capacities[reverseArc] = Int(0);
+		m_reverse[arc] = reverseArc;
+		m_reverse[reverseArc] = arc;
+		// Arcs with zero capacity are at the end of the order.
+		m_byCapacity[arc] = arc;
+		m_byCapacity[reverseArc] = reverseArc;
+		m_arcCount += 2;
+	}
+	Int previous = m_capacities[arc];
+	if (previous == _capacity)
+		return previous;
+	m_capacities[arc] = _capacity;
+	reorder(from, arc);
+	return previous;
+}
+
+void FlowGraph::compact()
+{
+	log_debug("-> FlowGraph::compact()");
+
+	vector<ArcId> newIndex(m_targets.size(), NoArc);
+	ArcId count = 0;
+	for (NodeId node = 0; node < m_nodes.size(); node++)
+		for (ArcId arc = m_arcBegin[node]; arc < m_arcEnd[node]; arc++)
+			if (m_capacities[arc] != Int(0) || m_capacities[m_reverse[arc]] != Int(0))
+				newIndex[arc] = count++;
+
+	vector<NodeId> targets(count);
+	vector<Int> capacities(count);
+	vector<ArcId> reverse(count);
+	vector<ArcId> byCapacity(count);
+	for (NodeId node = 0; node < m_nodes.size(); node++)
+	{
+		ArcId begin = NoArc;
+		ArcId end = 0;
+		for (ArcId arc = m_arcBegin[node]; arc < m_arcEnd[node]; arc++)
+			if (ArcId index = newIndex[arc]; index != NoArc)
+			{
+				targets[index] = m_targets[arc];
+				capacities[index] = m_capacities[arc];
+				reverse[index] = newIndex[m_reverse[arc]];
+				begin = min(begin, index);
+				end = index + 1;
+			}
+		if (begin == NoArc)
+			begin = end = node == 0 ? 0 : m_arcEnd[node - 1];
+		// Keep the order, only dropping the removed arcs.
+		ArcId position = begin;
+		for (ArcId i = m_arcBegin[node]; i < m_arcEnd[node]; i++)
+			if (ArcId index = newIndex[m_byCapacity[i]]; index != NoArc)
+				byCapacity[position++] = index;
+		m_arcBegin[node] = begin;
+		m_arcEnd[node] = end;
+	}
+	m_arcLimit = m_arcEnd;
+	m_targets = move(targets);
+	m_capacities = move(capacities);
+	m_reverse = move(reverse);
+	m_byCapacity = move(byCapacity);
+	m_holes = 0;
+	m_arcCount = count;
+
+	log_debug("<- FlowGraph::compact()");
+}
+
+NodeId FlowGraph::addNode(FlowGraphNode const& _node)
+{
+	NodeId id = nodeId(_node);
+	if (id != NoNode)
+		return id;
+
+	require(m_nodes.size() < NoNode);
+	id = NodeId(m_nodes.size());
+	m_nodes.push_back(_node);
+	if (auto const* address = get_if<AddressId>(&_node))
+	{
+		if (m_addressNodes.size() <= *address)
+			m_addressNodes.resize(*address + 1, NoNode);
+		m_addressNodes[*address] = id;
+	}
+	else
+	{
+		auto const& [from, token] = get<1>(_node);
+		m_pseudoNodes[pseudoKey(from, token)] = id;
+	}
+	ArcId end = ArcId(m_targets.size());
+	m_arcBegin.push_back(end);
+	m_arcEnd.push_back(end);
+	m_arcLimit.push_back(end);
+	return id;
+}
+
+ArcId FlowGraph::findArc(NodeId _from, NodeId _to) const
+{
+	for (ArcId arc = m_arcBegin[_from]; arc < m_arcEnd[_from]; arc++)
+		if (m_targets[arc] == _to)
+			return arc;
+	return NoArc;
+}
+
+void FlowGraph::reserveArc(NodeId _node)
+{
+	if (m_arcEnd[_node] < m_arcLimit[_node])
+		return;
+
+	ArcId begin = m_arcBegin[_node];
+	ArcId count = m_arcEnd[_node] - begin;
+	ArcId reserved = max<ArcId>(2 * count, 4);
+	require(m_targets.size() + reserved < NoArc);
+	ArcId newBegin = ArcId(m_targets.size());
+	if (m_arcLimit[_node] == newBegin)
+		// Already at the end of the arrays, we can just grow in place.
+		newBegin = begin;
+	else
+		m_holes += m_arcLimit[_node] - begin;
+
+	m_targets.resize(m_targets.size() + reserved, NoNode);
+	m_capacities.resize(m_capacities.size() + reserved);
+	m_reverse.resize(m_reverse.size() + reserved, NoArc);
+	m_byCapacity.resize(m_byCapacity.size() + reserved, NoArc);
+
+	if (newBegin != begin)
+		for (ArcId i = 0; i < count; i++)
+		{
+			ArcId arc = newBegin + i;
+			m_targets[arc] = m_targets[begin + i];
+			m_capacities[arc] = m_capacities[begin + i];
+			m_reverse[arc] = m_reverse[begin + i];
+			m_reverse[m_reverse[arc]] = arc;
+			m_byCapacity[arc] = m_byCapacity[begin + i] - begin + newBegin;
+			m_targets[begin + i] = NoNode;
+		}
+	m_arcBegin[_node] = newBegin;
+	m_arcEnd[_node] = newBegin + count;
+	m_arcLimit[_node] = ArcId(m_targets.size());
+}
+
+void FlowGraph::reorder(NodeId _node, ArcId _arc)
+{
+	FlowGraphView graph = view();
+	auto before = [&](ArcId _a, ArcId _b) {
+		return graph.capacityBefore(m_capacities[_a], m_targets[_a], m_capacities[_b], m_targets[_b]);
+	};
+	ArcId begin = m_arcBegin[_node];
+	ArcId end = m_arcEnd[_node];
+	ArcId i = ArcId(find(m_byCapacity.begin() + begin, m_byCapacity.begin() + end, _arc) - m_byCapacity.begin());
+	require(i < end);
+	for (; i > begin && before(_arc, m_byCapacity[i - 1]); i--)
+		m_byCapacity[i] = m_byCapacity[i - 1];
+	for (; i + 1 < end && before(m_byCapacity[i + 1], _arc); i++)
+		m_byCapacity[i] = m_byCapacity[i + 1];
+	m_byCapacity[i] = _arc;
+}
+
+ResidualGraph::ResidualGraph(FlowGraphView const& _graph, Arena& _arena):
+	m_graph(_graph),
+	m_arena(&_arena),
+	m_stateIndex(_arena.allocate<uint32_t>(_graph.nodeCount)),
+	m_mark(_arena.mark()),
+	m_states(_arena),
+	m_touched(_arena)
+{
+	fill(m_stateIndex, m_stateIndex + _graph.nodeCount, NoState);
+}
+
+ArcId const* ResidualGraph::byCapacity(NodeId _node)
+{
+	uint32_t index = m_stateIndex[_node];
+	if (index == NoState)
+		return m_graph.byCapacity + m_graph.begin(_node);
+	NodeState& s = m_states[index];
+	if (s.dirty)
+	{
+		m_graph.sortByCapacity(_node, s.residual, s.byCapacity);
+		s.dirty = false;
+	}
+	return s.byCapacity;
+}
+
+void ResidualGraph::push(NodeId _node, ArcId _arc, Int const& _flow)
+{
+	NodeState& from = state(_node);
+	from.residual[_arc - m_graph.begin(_node)] -= _flow;
+	from.dirty = true;
+	NodeId target = m_graph.targets[_arc];
+	NodeState& to = state(target);
+	to.residual[m_graph.reverse[_arc] - m_graph.begin(target)] += _flow;
+	to.dirty = true;
+}
+
+Int ResidualGraph::flow(NodeId, ArcId _arc) const
+{
+	if (m_graph.capacities[_arc] == Int(0))
+		return {};
+	// For original arcs, the reverse arc has zero capacity.
+	return residual(m_graph.targets[_arc], m_graph.reverse[_arc]);
+}
+
+ResidualGraph::NodeState& ResidualGraph::state(NodeId _node)
+{
+	uint32_t& index = m_stateIndex[_node];
+	if (index == NoState)
+	{
+		index = uint32_t(m_touched.size());
+		ArcId begin = m_graph.begin(_node);
+		ArcId end = m_graph.end(_node);
+		NodeState& s = m_states.emplace_back();
+		s.residual = m_arena->allocate<Int>(end - begin);
+		s.byCapacity = m_arena->allocate<ArcId>(end - begin);
+		copy(m_graph.capacities + begin, m_graph.capacities + end, s.residual);
+		copy(m_graph.byCapacity + begin, m_graph.byCapacity + end, s.byCapacity);
+		m_touched.push_back(_node);
+	}
+	return m_states[index];
+}
+
+void ResidualGraph::reset()
+{
+	for (NodeId node: m_touched)
+		m_stateIndex[node] = NoState;
+	// The buffers of the vectors are released as well, so they cannot be kept.
+	m_states = ArenaVector<NodeState>(*m_arena);
+	m_touched = ArenaVector<NodeId>(*m_arena);
+	m_arena->rewind(m_mark);
+}
@@ -0,0 +1,254 @@
+#pragma once
+
+#include "arena.h"
+#include "types.h"
+
+#include <memory>
+#include <tuple>
+#include <unordered_map>
+
+/// Dense id of a node in a flow graph.
+using NodeId = uint32_t;
+/// Index of an arc in a flow graph.
+using ArcId = uint32_t;
+
+static constexpr NodeId NoNode = NodeId(-1);
+static constexpr ArcId NoArc = ArcId(-1);
+
+class ReachabilityIndex;
+
+/// Arc given by its end points and capacity, used to build a FlowGraph in bulk.
+using FlowGraphArc = std::tuple<FlowGraphNode, FlowGraphNode, Int>;
+
+/// Read-only view of a flow graph in compressed sparse row form.
+///
+/// The arcs of node `n` are the indices `arcBegin[n]` to `arcEnd[n]` into
+/// the arc arrays. Every arc has a reverse arc (with zero capacity if
+/// it is not part of the original graph), so the arrays can directly be
+/// used as a residual graph.
+struct FlowGraphView
+{
+	size_t nodeCount = 0;
+	/// Node id to node.
+	FlowGraphNode const* nodes = nullptr;
+	ArcId const* arcBegin = nullptr;
+	ArcId const* arcEnd = nullptr;
+	NodeId const* targets = nullptr;
+	Int const* capacities = nullptr;
+	/// Index of the reverse arc of each arc.
+	ArcId const* reverse = nullptr;
+	/// The arcs of each node (again at `arcBegin[n]` to `arcEnd[n]`)
+	/// sorted by `capacityBefore`.
+	ArcId const* byCapacity = nullptr;
+	/// Address handle to the id of its actual node or NoNode.
+	NodeId const* addressNodes = nullptr;
+	size_t addressCount = 0;
+	/// Optional index of the graph, only set for graphs that do not change.
+	ReachabilityIndex const* reachability = nullptr;
+
+	ArcId begin(NodeId _node) const { return arcBegin[_node]; }
+	ArcId end(NodeId _node) const { return arcEnd[_node]; }
+
+	/// @returns the id of the actual node of @a _address or NoNode if it is not part of the graph.
+	NodeId nodeId(AddressId _address) const
+	{
+		return _address < addressCount ? addressNodes[_address] : NoNode;
+	}
+
+	/// Order of the arcs of a node as visited by the augmenting path search:
+	/// By decreasing capacity and then by decreasing target node.
+	bool capacityBefore(Int const& _capacityA, NodeId _targetA, Int const& _capacityB, NodeId _targetB) const;
+	/// Sorts the arcs of @a _node in @a _order by `capacityBefore`, where the capacity of
+	/// arc `a` is `_capacities[a - begin(_node)]`.
+	void sortByCapacity(NodeId _node, Int const* _capacities, ArcId* _order) const;
+
+	/// @returns the number of arcs with non-zero capacity that leave pseudo-nodes,
+	/// i.e. the number of edges of the trust graph (see DB).
+	size_t edgeCount() const;
+
+	/// Throws if the arcs of the nodes are not within the first @a _arcCount
+	/// entries of the arrays or are inconsistent, e.g. because they were read from a corrupted file.
+	void validate(size_t _arcCount) const;
+
+	/// Orders nodes by their addresses (not by their handles), actual nodes first.
+	static bool nodeLess(FlowGraphNode const& _a, FlowGraphNode const& _b);
+};
+
+/// Flow graph that can be patched arc by arc.
+///
+/// Node ids are stable and the arcs of each node are stored contiguously,
+/// with some slack at the end. If a node runs out of slack, its arcs are
+/// moved to the end of the arrays, and once too many of these holes have
+/// accumulated, the graph is compacted. Arc indices are only stable
+/// between modifications.
+/// Arcs are never removed individually, their capacity is just set to zero.
+class FlowGraph
+{
+public:
+	FlowGraph() = default;
+
+	/// Builds the graph from a list of (from, to, capacity) arcs in one go.
+	/// Reverse arcs are added automatically, of duplicate arcs the one with the
+	/// maximum capacity is kept.
+	static FlowGraph fromArcs(std::vector<FlowGraphArc> const& _arcs);
+
+	/// Takes over the arrays of a compacted graph, e.g. as stored in a snapshot.
+	/// The arcs of node `n` are `_offsets[n]` to `_offsets[n + 1]`.
+	/// Throws if the arrays are inconsistent.
+	static FlowGraph fromArrays(
+		std::vector<FlowGraphNode> _nodes,
+		std::vector<ArcId> const& _offsets,
+		std::vector<NodeId> _targets,
+		std::vector<Int> _capacities,
+		std::vector<ArcId> _reverse,
+		std::vector<ArcId> _byCapacity
+	);
+
+	FlowGraphView view() const;
+
+	size_t nodeCount() const { return m_nodes.size(); }
+	/// @returns the number of arcs including the reverse arcs.
+	size_t arcCount() const { return m_arcCount; }
+
+	/// @returns the id of the node or NoNode if it is not part of the graph.
+	NodeId nodeId(FlowGraphNode const& _node) const;
+	FlowGraphNode const& node(NodeId _node) const { return m_nodes[_node]; }
+
+	/// @returns the capacity of the arc from @a _from to @a _to (zero if it does not exist).
+	Int capacity(FlowGraphNode const& _from, FlowGraphNode const& _to) const;
+
+	/// Sets the capacity of the arc from @a _from to @a _to, adding the nodes,
+	/// the arc and its reverse arc if they do not exist yet.
+	/// @returns the previous capacity.
+	Int setCapacity(FlowGraphNode const& _from, FlowGraphNode const& _to, Int const& _capacity);
+
+	/// Rebuilds the arrays without holes and without arcs that have zero
+	/// capacity in both directions. Afterwards, the arcs of all nodes
+	/// are contiguous and in node order.
+	void compact();
+
+private:
+	friend class FrozenFlowGraph;
+
+	NodeId addNode(FlowGraphNode const& _node);
+	ArcId findArc(NodeId _from, NodeId _to) const;
+	/// Makes sure @a _node has space for at least one more arc.
+	void reserveArc(NodeId _node);
+	/// Restores the `byCapacity` order of @a _node after the capacity of @a _arc changed.
+	void reorder(NodeId _node, ArcId _arc);
+
+	static uint64_t pseudoKey(AddressId _from, AddressId _token) { return (uint64_t(_from) << 32) | _token; }
+
+	std::vector<FlowGraphNode> m_nodes;
+	std::vector<NodeId> m_addressNodes;
+	std::unordered_map<uint64_t, NodeId> m_pseudoNodes;
+
+	std::vector<ArcId> m_arcBegin;
+	std::vector<ArcId> m_arcEnd;
+	/// End of the space reserved for the arcs of each node.
+	std::vector<ArcId> m_arcLimit;
+
+	std::vector<NodeId> m_targets;
+	std::vector<Int> m_capacities;
+	std::vector<ArcId> m_reverse;
+	std::vector<ArcId> m_byCapacity;
+	/// Number of array entries not belonging to any node.
+	size_t m_holes = 0;
+	size_t m_arcCount = 0;
+};
+
+/// Copy of a FlowGraph that can only be queried.
+/// It leaves out the lookup structures that are only needed to patch
+/// the graph, which makes it several times faster to create than a copy
+/// of the FlowGraph.
+class FrozenFlowGraph
+{
+public:
+	/// Also builds the reachability index of the copy.
+	explicit FrozenFlowGraph(FlowGraph const& _graph);
+	~FrozenFlowGraph();
+	FrozenFlowGraph(FrozenFlowGraph const&) = delete;
+	FrozenFlowGraph& operator=(FrozenFlowGraph const&) = delete;
+
+	FlowGraphView const& view() const { return m_view; }
+
+private:
+	std::vector<FlowGraphNode> m_nodes;
+	std::vector<NodeId> m_addressNodes;
+	std::vector<ArcId> m_arcBegin;
+	std::vector<ArcId> m_arcEnd;
+	std::vector<NodeId> m_targets;
+	std::vector<Int> m_capacities;
+	std::vector<ArcId> m_reverse;
+	std::vector<ArcId> m_byCapacity;
+	std::unique_ptr<ReachabilityIndex const> m_reachability;
+	FlowGraphView m_view;
+};
+
+/// Residual graph of a query on top of a read-only flow graph.
+///
+/// The residual capacities of a node are copied from the flow graph the
+/// first time flow is pushed along one of its arcs, all other nodes
+/// read the flow graph directly.
+///
+/// All memory comes from an arena, which the algorithms running on the
+/// overlay also use for their scratch data. Nothing allocated from the
+/// arena after the overlay may be used beyond the next reset().
+class ResidualGraph
+{
+public:
+	explicit ResidualGraph(FlowGraphView const& _graph, Arena& _arena = Arena::forThread());
+	ResidualGraph(ResidualGraph const&) = delete;
+	ResidualGraph& operator=(ResidualGraph const&) = delete;
+
+	FlowGraphView const& graph() const { return m_graph; }
+	/// @returns the arena for the scratch data of the current query.
+	Arena& arena() const { return *m_arena; }
+
+	/// @returns the residual capacity of @a _arc, which is an arc of @a _node.
+	Int const& residual(NodeId _node, ArcId _arc) const
+	{
+		uint32_t state = m_stateIndex[_node];
+		return state == NoState ? m_graph.capacities[_arc] : m_states[state].residual[_arc - m_graph.begin(_node)];
+	}
+	/// @returns the arcs of @a _node sorted by decreasing residual capacity.
+	ArcId const* byCapacity(NodeId _node);
+
+	/// Sends @a _flow along @a _arc, which is an arc of @a _node.
+	void push(NodeId _node, ArcId _arc, Int const& _flow);
+
+	/// @returns the flow along @a _arc, which is an arc of @a _node, if it is an original arc.
+	Int flow(NodeId _node, ArcId _arc) const;
+
+	/// @returns the nodes whose residual capacities differ from the flow graph.
+	ArenaVector<NodeId> const& touchedNodes() const { return m_touched; }
+
+	/// Removes all flow, so that the overlay can be used for another query
+	/// on the same graph, and releases everything allocated from the arena since
+	/// the overlay was created.
+	void reset();
+
+private:
+	static constexpr uint32_t NoState = uint32_t(-1);
+
+	struct NodeState
+	{
+		/// Residual capacity of the arcs of the node, indexed by `arc - begin(node)`.
+		Int* residual = nullptr;
+		ArcId* byCapacity = nullptr;
+		/// Whether `byCapacity` needs to be re-sorted.
+		bool dirty = false;
+	};
+
+	NodeState& state(NodeId _node);
+
+	FlowGraphView m_graph;
+	Arena* m_arena = nullptr;
+	/// Index into `m_states` for each node, allocated before `m_mark`.
+	uint32_t* m_stateIndex = nullptr;
+	/// Position in the arena that reset() rewinds to.
+	Arena::Mark m_mark;
+	/// States of the touched nodes, in the order of `m_touched`.
+	ArenaVector<NodeState> m_states;
+	ArenaVector<NodeId> m_touched;
+};
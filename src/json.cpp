@@ -0,0 +1,161 @@
+#include "json.h"
+
+#include "exceptions.h"
+#include "encoding.h"
+
+#include <cctype>
+
+using namespace std;
+
+void skipWhitespace(string_view _input, size_t& _pos)
+{
+	while (_pos < _input.size() && (_input[_pos] == ' ' || _input[_pos] == '\t' || _input[_pos] == '\n' || _input[_pos] == '\r'))
+		_pos++;
+}
+
+/// Reads the string starting at the quote at @a _pos and moves @a _pos behind it.
+/// @returns its contents, with the escape sequences resolved.
+string readString(string_view _input, size_t& _pos)
+{
+	if (_pos >= _input.size() || _input[_pos] != '"')
+		throw InvalidArgumentException();
+	_pos++;
+	string result;
+	while (true)
+	{
+		if (_pos >= _input.size())
+			throw InvalidArgumentException();
+		char c = _input[_pos++];
+		if (c == '"')
+			return result;
+		if (c != '\\')
+		{
+			result.push_back(c);
+			continue;
+		}
+		if (_pos >= _input.size())
+			throw InvalidArgumentException();
+		switch (_input[_pos++])
+		{
+		case '"': result.push_back('"'); break;
+		case '\\': result.push_back('\\'); break;
+		case '/': result.push_back('/'); break;
+		case 'b': result.push_back('\b'); break;
+		case 'f': result.push_back('\f'); break;
+		case 'n': result.push_back('\n'); break;
+		case 'r': result.push_back('\r'); break;
+		case 't': result.push_back('\t'); break;
+		case 'u':
+		{
+			if (_pos + 4 > _input.size())
+				throw InvalidArgumentException();
+			unsigned code = 0;
+			for (size_t i = 0; i < 4; i++)
+			{
+				char digit = _input[_pos++];
+				if (!isxdigit(static_cast<unsigned char>(digit)))
+					throw InvalidArgumentException();
+				code = (code << 4) | fromHex(digit);
+			}
+			// Surrogate pairs are not needed for the requests, so they are not combined.
+			if (code < 0x80)
+				result.push_back(char(code));
+			else if (code < 0x800)
+			{
+				result.push_back(char(0xc0 | (code >> 6)));
+				result.push_back(char(0x80 | (code & 0x3f)));
+			}
+			else
+			{
+				result.push_back(char(0xe0 | (code >> 12)));
+				result.push_back(char(0x80 | ((code >> 6) & 0x3f)));
+				result.push_back(char(0x80 | (code & 0x3f)));
+			}
+			break;
+		}
+		default:
+			throw InvalidArgumentException();
+		}
+	}
+}
+
+map<string, string> parseFlatJsonObject(string_view _input)
+{
+	map<string, string> members;
+	size_t pos = 0;
+	skipWhitespace(_input, pos);
+	if (pos >= _input.size() || _input[pos] != '{')
+		throw InvalidArgumentException();
+	pos++;
+	skipWhitespace(_input, pos);
+	if (pos < _input.size() && _input[pos] == '}')
+		pos++;
+	else
+		while (true)
+		{
+			skipWhitespace(_input, pos);
+			string key = readString(_input, pos);
+			skipWhitespace(_input, pos);
+			if (pos >= _input.size() || _input[pos] != ':')
+				throw InvalidArgumentException();
+			pos++;
+			skipWhitespace(_input, pos);
+			size_t valueBegin = pos;
+			if (pos < _input.size() && _input[pos] == '"')
+				readString(_input, pos);
+			else
+				while (pos < _input.size() && (isalnum(static_cast<unsigned char>(_input[pos])) || _input[pos] == '-' || _input[pos] == '+' || _input[pos] == '.'))
+					pos++;
+			if (pos == valueBegin)
+				throw InvalidArgumentException();
+			members[move(key)] = string(_input.substr(valueBegin, pos - valueBegin));
+			skipWhitespace(_input, pos);
+			if (pos < _input.size() && _input[pos] == ',')
+				pos++;
+			else if (pos < _input.size() && _input[pos] == '}')
+			{
+				pos++;
+				break;
+			}
+			else
+				throw InvalidArgumentException();
+		}
+	skipWhitespace(_input, pos);
+	if (pos != _input.size())
+		throw InvalidArgumentException();
+	return members;
+}
+
+string jsonValueText(string_view _json)
+{
+	if (!_json.empty() && _json[0] == '"')
+	{
+		size_t pos = 0;
+		return readString(_json, pos);
+	}
+	return string(_json);
+}
+
+string jsonString(string_view _value)
+{
+	string result = "\"";
+	for (char c: _value)
+		switch (c)
+		{
+		case '"': result += "\\\""; break;
+		case '\\': result += "\\\\"; break;
+		case '\n': result += "\\n"; break;
+		case '\r': result += "\\r"; break;
+		case '\t': result += "\\t"; break;
+		default:
+			if (static_cast<unsigned char>(c) < 0x20)
+			{
+				result += "\\u00";
+				result.push_back(toHex(uint8_t(c) >> 4));
+				result.push_back(toHex(uint8_t(c) & 0xf));
+			}
+			else
+				result.push_back(c);
+		}
+	return result + "\"";
+}
@@ -0,0 +1,20 @@
+#pragma once
+
+#include <map>
+#include <string>
+#include <string_view>
+
+/// Minimal JSON support for the requests and responses of the JSON mode.
+
+/// Parses a JSON object whose values are strings, numbers, booleans or null,
+/// i.e. without nested objects or arrays.
+/// @returns the members with their values as JSON text, i.e. strings still quoted.
+/// Throws InvalidArgumentException if @a _input is not such an object.
+std::map<std::string, std::string> parseFlatJsonObject(std::string_view _input);
+
+/// @returns the value of @a _json if it is a string and its text otherwise
+/// (e.g. to accept both "100" and 100 for a number).
+std::string jsonValueText(std::string_view _json);
+
+/// @returns @a _value as a quoted and escaped JSON string.
+std::string jsonString(std::string_view _value);
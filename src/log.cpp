@@ -21,6 +21,7 @@
  */
 
 #include "log.h"
+#include <mutex>
 #include <unistd.h>
 
 using std::chrono::duration_cast;
@@ -108,13 +109,19 @@ static void stdout_callback(log_Event *ev) {
     fflush(ev->udata);
 }
 
+/// Used if no lock function is set, since the nesting and stopwatch state
+/// (and localtime) must not be used by several threads at once.
+static std::mutex defaultLock;
+
 static void lock(void) {
     if (L.lock) { L.lock(true, L.udata); }
+    else { defaultLock.lock(); }
 }
 
 
 static void unlock(void) {
     if (L.lock) { L.lock(false, L.udata); }
+    else { defaultLock.unlock(); }
 }
 
 
@@ -1,29 +1,228 @@
 #include "flow.h"
+#include "arena.h"
+#include "binaryExporter.h"
 #include "binaryImporter.h"
-
+#include "cutTree.h"
+#include "json.h"
+#include "mappedFile.h"
+#include "parallel.h"
+#include "sharedSnapshot.h"
+
+#include <atomic>
+#include <cstring>
+#include <fstream>
+#include <functional>
 #include <iostream>
+#include <memory>
+#include <mutex>
 #include <sstream>
 #include "log.h"
 #include "types.h"
+#include "exceptions.h"
 
 using namespace std;
 
 DB db;
+/// Serializes all functions that read or modify db, there is only a single writer.
+/// Flow queries run on graphVersion and only take it to copy a new version,
+/// but never wait for it.
+mutex dbMutex;
+/// The flow graph of db as of the end of a modification, see currentGraphVersion().
+/// Flow queries pin it when they start and keep using it even if it is replaced meanwhile.
+shared_ptr<GraphVersion const> graphVersion = make_shared<GraphVersion const>(db);
+/// DB::generation() as of the end of the last modification that left no edge
+/// updates pending, i.e. the generation that graphVersion is supposed to have.
+atomic<uint64_t> dbGeneration{0};
+/// Set by queries that found graphVersion outdated while dbMutex was held, so that
+/// the next modification builds the new version right away when it is done.
+atomic<bool> graphVersionRequested{false};
+/// Set if flows are computed on a shared snapshot instead of on db.
+/// Only accessed via atomic_load and atomic_store, since attachSnapshot() can
+/// replace it while queries run.
+shared_ptr<SharedSnapshotReader> snapshotReader;
+/// Block number of the last DB that was loaded.
+atomic<size_t> dbBlockNumber{0};
+/// Set if the cut tree index of graphVersion is maintained, see enableFlowIndex().
+shared_ptr<CutTreeBuilder> cutTreeBuilder;
+
+/// Replaces graphVersion by a copy of the flow graph of db, unless it is up to
+/// date and @a _force is not set.
+/// Has to be called with dbMutex locked and without pending edge updates.
+void buildGraphVersion(bool _force)
+{
+    if (!_force && atomic_load(&graphVersion)->generation == db.generation())
+        return;
+    shared_ptr<GraphVersion const> version = make_shared<GraphVersion const>(db);
+    atomic_store(&graphVersion, version);
+    if (shared_ptr<CutTreeBuilder> builder = atomic_load(&cutTreeBuilder))
+        builder->update(move(version), _force);
+}
+
+/// Makes the state of db available to queries at the end of a modification,
+/// unless edge updates are pending, in which case queries stay on the last
+/// consistent version. Copying the graph takes time linear in its size, so it
+/// is only done once a query needs the new version (see currentGraphVersion()),
+/// which coalesces the modifications in between. It is done right away if
+/// @a _force is set (even if the generation did not change), if a query asked
+/// for it meanwhile or if the cut tree index is maintained.
+/// Has to be called with dbMutex locked.
+void publishGraphVersion(bool _force = false)
+{
+    if (db.hasPendingEdgeUpdates())
+        return;
+    dbGeneration = db.generation();
+    if (graphVersionRequested.exchange(false) || _force || atomic_load(&cutTreeBuilder))
+        buildGraphVersion(_force);
+}
+
+/// @returns the flow graph of db as of the end of the last modification, which is
+/// copied now if no query needed it before. Queries do not wait for a running
+/// modification, though: If dbMutex is held, they get the latest version that
+/// was built and the modification builds the new one when it is done.
+shared_ptr<GraphVersion const> currentGraphVersion()
+{
+    shared_ptr<GraphVersion const> version = atomic_load(&graphVersion);
+    if (version->generation == dbGeneration)
+        return version;
+    unique_lock<mutex> lock(dbMutex, try_to_lock);
+    if (!lock.owns_lock()) {
+        graphVersionRequested = true;
+        return version;
+    }
+    if (!db.hasPendingEdgeUpdates())
+        buildGraphVersion(false);
+    return atomic_load(&graphVersion);
+}
+
+/// The flow graph a query is answered on: the current snapshot if one is
+/// attached and the current version of db otherwise. It stays valid as long
+/// as the query holds on to it.
+struct PinnedGraph {
+    shared_ptr<SharedSnapshot const> snapshot;
+    shared_ptr<GraphVersion const> version;
+    /// The latest cut tree of db, which can be older than version.
+    shared_ptr<CutTree const> cutTree;
+
+    FlowGraphView const& graph() const { return snapshot ? snapshot->graph() : version->graph.view(); }
+    vector<AddressId> const& tokenOwners() const { return snapshot ? snapshot->tokenOwners() : version->tokenOwners; }
+    size_t edgeCount() const { return snapshot ? snapshot->edgeCount() : version->edgeCount; }
+};
+
+PinnedGraph pinGraph() {
+    if (shared_ptr<SharedSnapshotReader> reader = atomic_load(&snapshotReader)) {
+        reader->refresh();
+        return {reader->current(), nullptr, nullptr};
+    }
+    shared_ptr<CutTreeBuilder> builder = atomic_load(&cutTreeBuilder);
+    shared_ptr<GraphVersion const> version = currentGraphVersion();
+    return {nullptr, move(version), builder ? builder->current() : nullptr};
+}
+
+/// @returns @a _transfer, computed on @a _pinned, as JSON in the format of the /flow endpoint.
+string transferJson(PinnedGraph const& _pinned, Edge const& _transfer) {
+    vector<AddressId> const& tokenOwners = _pinned.tokenOwners();
+    AddressId tokenOwner = _transfer.token < tokenOwners.size() ? tokenOwners[_transfer.token] : AddressTable::Zero;
+    return
+        "{\"from\":\"" + to_string(address(_transfer.from)) + "\"," +
+        "\"to\":\"" + to_string(address(_transfer.to)) + "\"," +
+        "\"token\":\"" + to_string(address(_transfer.token)) + "\"," +
+        "\"tokenOwner\":\"" + to_string(address(tokenOwner)) + "\"," +
+        "\"value\":\"" + to_string(_transfer.capacity) + "\"}";
+}
+
+/// @returns @a _flow and the @a _transfers that realize it, computed on @a _pinned,
+/// as JSON in the format of the /flow endpoint.
+string flowJson(PinnedGraph const& _pinned, Int const& _flow, vector<Edge> const& _transfers) {
+    string result = "{\"flow\":\"" + to_string(_flow) + "\",\"transfers\":[";
+    for (size_t i = 0; i < _transfers.size(); i++)
+        result += (i == 0 ? "" : ",") + transferJson(_pinned, _transfers[i]);
+    return result + "]}";
+}
+
+/// Computes the max flow (up to @a _value) from @a _source to @a _sink on @a _pinned
+/// and passes it together with the transfers that realize it to @a _write as JSON
+/// in the format of the /flow endpoint, piece by piece while they are extracted.
+void writeFlowJson(
+    PinnedGraph const& _pinned,
+    Address const& _source,
+    Address const& _sink,
+    Int const& _value,
+    function<void(string const&)> const& _write
+) {
+    auto writeFlow = [&](Int const& _flow) { _write("{\"flow\":\"" + to_string(_flow) + "\",\"transfers\":["); };
+    optional<AddressId> source = addressTable().find(_source);
+    optional<AddressId> sink = addressTable().find(_sink);
+    if (!source || !sink)
+        writeFlow(Int(0));
+    else {
+        bool first = true;
+        computeFlow(*source, *sink, _pinned.graph(), _value, writeFlow, [&](Edge const& _transfer) {
+            _write((first ? "" : ",") + transferJson(_pinned, _transfer));
+            first = false;
+        });
+    }
+    _write("]}");
+}
+
+/// @returns the max flow value (up to @a _value) from @a _source to @a _sink on
+/// @a _pinned as JSON: {"flow": <value>, "generation": <generation of the graph>}.
+/// Uses the cut tree only to answer zero right away, and only if it is up to date.
+string flowValueJson(PinnedGraph const& _pinned, Address const& _source, Address const& _sink, Int const& _value) {
+    optional<AddressId> source = addressTable().find(_source);
+    optional<AddressId> sink = addressTable().find(_sink);
+    Int flow{0};
+    if (source && sink) {
+        bool cannotSend =
+            _pinned.cutTree &&
+            _pinned.cutTree->generation() == _pinned.version->generation &&
+            _pinned.cutTree->upperBound(*source, *sink) == Int(0);
+        if (!cannotSend)
+            flow = computeMaxFlow(*source, *sink, _pinned.graph(), _value);
+    }
+    return
+        "{\"flow\":\"" + to_string(flow) +
+        "\",\"generation\":" + to_string(_pinned.version ? _pinned.version->generation : 0) + "}";
+}
+
+/// @returns the upper bound on the max flow from @a _source to @a _sink of the
+/// cut tree of @a _pinned as JSON: {"bound": <value>, "generation": <generation
+/// of the tree>, "stale": <whether the graph changed since>}.
+/// Throws if there is no tree.
+string flowBoundJson(PinnedGraph const& _pinned, Address const& _source, Address const& _sink) {
+    if (!_pinned.cutTree)
+        throw Exception();
+    optional<AddressId> source = addressTable().find(_source);
+    optional<AddressId> sink = addressTable().find(_sink);
+    Int bound = source && sink ? _pinned.cutTree->upperBound(*source, *sink) : Int(0);
+    bool stale = _pinned.cutTree->generation() != _pinned.version->generation;
+    return
+        "{\"bound\":\"" + to_string(bound) +
+        "\",\"generation\":" + to_string(_pinned.cutTree->generation()) +
+        ",\"stale\":" + (stale ? "true" : "false") + "}";
+}
+
 extern "C"
 {
 
+/// Loads the DB from @a _filename and throws if it cannot be opened or read.
+/// @returns its block number, which can be zero.
 size_t loadDbFromFile(char const *_filename) {
     log_debug("-> loadDB(_filename: '%s')", _filename);
-    ifstream input_file(_filename);
-    if (!input_file.is_open()) {
+    MappedFile file(_filename);
+    if (!file.isOpen()) {
         log_error("Could not open '%s'", _filename);
-        return 0;
+        throw Exception();
     }
 
+    lock_guard<mutex> lock(dbMutex);
     size_t blockNumber{};
-    tie(blockNumber, db) = BinaryImporter(input_file).readBlockNumberAndDB();
+    uint64_t generation = db.generation();
+    tie(blockNumber, db) = BinaryImporter(file.data(), file.size()).readBlockNumberAndDB();
+    // The generations continue, so versions and cut trees of different DBs cannot be mistaken for each other.
+    db.m_generation = generation + 1;
+    dbBlockNumber = blockNumber;
+    publishGraphVersion(true);
 
-    input_file.close();
     log_debug("<- loadDB(_filename: '%s')", _filename);
 
     return blockNumber;
@@ -32,25 +231,73 @@ size_t loadDbFromFile(char const *_filename) {
 size_t loadDB(char const *_data, size_t _length) {
     log_debug("-> loadDB(data: ..., _length: '%li')", _length);
 
-    string data(_data, _length);
-    istringstream stream(data);
-
+    lock_guard<mutex> lock(dbMutex);
     size_t blockNumber{};
-    tie(blockNumber, db) = BinaryImporter(stream).readBlockNumberAndDB();
+    uint64_t generation = db.generation();
+    tie(blockNumber, db) = BinaryImporter(reinterpret_cast<uint8_t const*>(_data), _length).readBlockNumberAndDB();
+    // The generations continue, so versions and cut trees of different DBs cannot be mistaken for each other.
+    db.m_generation = generation + 1;
+    dbBlockNumber = blockNumber;
+    publishGraphVersion(true);
 
     log_debug("<- loadDB(data: ..., _length: '%li')", _length);
     return blockNumber;
 }
 
+/// Writes the current state to a file, either as a snapshot including the flow
+/// graph, which loads fastest, or in the compact encoding, which is smallest
+/// (see BinaryExporter).
+bool saveDbToFile(char const *_filename, size_t _blockNumber, bool _compact) {
+    log_debug("-> saveDbToFile(_filename: '%s', _blockNumber: %li, _compact: %i)", _filename, _blockNumber, _compact);
+    ofstream output(_filename, ios::binary);
+    if (!output.is_open()) {
+        log_error("Could not open '%s'", _filename);
+        return false;
+    }
+    lock_guard<mutex> lock(dbMutex);
+    if (_compact)
+        BinaryExporter(output).writeCompact(_blockNumber, db);
+    else
+        BinaryExporter(output).write(_blockNumber, db);
+    log_debug("<- saveDbToFile(_filename: '%s', _blockNumber: %li, _compact: %i)", _filename, _blockNumber, _compact);
+    return bool(output);
+}
+
+/// Publishes the current state as a snapshot for other processes,
+/// replacing the previous one at @a _filename atomically.
+bool publishSnapshot(char const *_filename, size_t _blockNumber) {
+    log_debug("-* publishSnapshot(_filename: '%s', _blockNumber: %li)", _filename, _blockNumber);
+    lock_guard<mutex> lock(dbMutex);
+    return publishSnapshot(string(_filename), _blockNumber, db);
+}
+
+/// Computes flows on the snapshot published at @a _filename from now on,
+/// switching to newer snapshots as they are published.
+/// @returns the block number of the snapshot.
+size_t attachSnapshot(char const *_filename) {
+    log_info("-> attachSnapshot(_filename: '%s')", _filename);
+    auto reader = make_shared<SharedSnapshotReader>(_filename);
+    size_t blockNumber = reader->current()->blockNumber();
+    atomic_store(&snapshotReader, move(reader));
+    log_info("<- attachSnapshot(_filename: '%s')", _filename);
+    return blockNumber;
+}
+
 Flow computeFlow(
         Address const &_source,
         Address const &_sink,
         Int const &_value
 ) {
     log_debug("-> computeFlow(source:'%s', sink: '%s', value: %s)", to_string(_source).c_str(), to_string(_sink).c_str(), to_string(_value).c_str());
-    log_debug("   computeFlow(source:'%s', sink: '%s', value: %s): Total edge count: %li", to_string(_source).c_str(), to_string(_sink).c_str(), to_string(_value).c_str(), db.m_edges.size());
 
-    auto[flow, transfers] = computeFlow(_source, _sink, db.edges(), _value);
+    optional<AddressId> source = addressTable().find(_source);
+    optional<AddressId> sink = addressTable().find(_sink);
+    if (!source || !sink)
+        return Flow(Int(0), {});
+
+    PinnedGraph pinned = pinGraph();
+    log_debug("   computeFlow(source:'%s', sink: '%s', value: %s): Total edge count: %li", to_string(_source).c_str(), to_string(_sink).c_str(), to_string(_value).c_str(), pinned.edgeCount());
+    auto[flow, transfers] = computeFlow(*source, *sink, pinned.graph(), _value);
 
     log_debug("   computeFlow(source:'%s', sink: '%s', value: %s): Max flow: %s", to_string(_source).c_str(), to_string(_sink).c_str(), to_string(_value).c_str(), to_string(flow).c_str());
     log_debug("<- computeFlow(source:'%s', sink: '%s', value: %s)", to_string(_source).c_str(), to_string(_sink).c_str(), to_string(_value).c_str());
@@ -58,40 +305,265 @@ Flow computeFlow(
     return Flow(flow, transfers);
 }
 
+/// Computes the flows of a batch of independent queries, one per line:
+///   <from> <to> [<value>]
+/// All of them run on the same version of the graph, distributed over
+/// setThreadCount() threads.
+/// @returns a JSON array with the result of each query in the order of the
+/// input, in the format of flow(). It stays valid until the next call on the
+/// same thread.
+char const* flowBatch(char const *_queries) {
+    log_info("-> flowBatch()");
+    PinnedGraph pinned = pinGraph();
+    vector<FlowQuery> queries;
+    /// Indices of the queries whose addresses are unknown, they have no flow.
+    vector<bool> unknown;
+    istringstream input{string(_queries)};
+    string line;
+    while (getline(input, line)) {
+        istringstream fields(line);
+        string from, to, value;
+        if (!(fields >> from))
+            continue;
+        if (!(fields >> to))
+            throw InvalidArgumentException();
+        optional<AddressId> source = addressTable().find(Address(from));
+        optional<AddressId> sink = addressTable().find(Address(to));
+        unknown.push_back(!source || !sink);
+        queries.push_back(FlowQuery{
+            source.value_or(AddressTable::Zero),
+            sink.value_or(AddressTable::Zero),
+            fields >> value ? Int(value) : Int::max()
+        });
+    }
+
+    vector<pair<Int, vector<Edge>>> results = computeFlows(queries, pinned.graph(), threadCount());
+
+    thread_local string output;
+    output = "[";
+    for (size_t i = 0; i < results.size(); i++) {
+        if (i > 0)
+            output += ",";
+        output += unknown[i] ? flowJson(pinned, Int(0), {}) : flowJson(pinned, results[i].first, results[i].second);
+    }
+    output += "]";
+    log_info("<- flowBatch(): %li queries", results.size());
+    return output.c_str();
+}
+
+/// Computes the max flow from @a _source to each of a list of sinks, one per line:
+///   <sink> [<value>]
+/// Work that only depends on the source is shared between the sinks.
+/// @returns a JSON array with the flow to each sink (as a decimal string) in
+/// the order of the input. It stays valid until the next call on the same thread.
+char const* flowsFrom(char const *_source, char const *_sinks) {
+    log_info("-> flowsFrom(_source: '%s')", _source);
+    PinnedGraph pinned = pinGraph();
+    optional<AddressId> source = addressTable().find(Address(string(_source)));
+    optional<FlowsFromSource> flows;
+    if (source)
+        flows.emplace(*source, pinned.graph());
+
+    thread_local string output;
+    output = "[";
+    istringstream input{string(_sinks)};
+    string line;
+    while (getline(input, line)) {
+        istringstream fields(line);
+        string sink, value;
+        if (!(fields >> sink))
+            continue;
+        optional<AddressId> sinkId = addressTable().find(Address(sink));
+        Int flow{0};
+        if (flows && sinkId)
+            flow = flows->flowTo(*sinkId, fields >> value ? Int(value) : Int::max());
+        if (output.size() > 1)
+            output += ",";
+        output += "\"" + to_string(flow) + "\"";
+    }
+    output += "]";
+    log_info("<- flowsFrom(_source: '%s')", _source);
+    return output.c_str();
+}
+
+/// Maintains a cut tree index of the graph on a background thread from now on,
+/// which answers upper bounds on flows (see CutTree). It is rebuilt after
+/// every change, which takes a max flow computation per address.
+/// Not available while a shared snapshot is attached.
+void enableFlowIndex() {
+    log_info("-> enableFlowIndex()");
+    lock_guard<mutex> lock(dbMutex);
+    if (!atomic_load(&cutTreeBuilder)) {
+        if (!db.hasPendingEdgeUpdates())
+            buildGraphVersion(false);
+        auto builder = make_shared<CutTreeBuilder>();
+        builder->update(atomic_load(&graphVersion));
+        atomic_store(&cutTreeBuilder, move(builder));
+    }
+    log_info("<- enableFlowIndex()");
+}
+
+/// @returns the max flow value from @a _from to @a _to (up to @a _value, if not empty)
+/// as JSON, see flowValueJson(). Cheaper than a flow query, since no transfers
+/// are extracted. It stays valid until the next call on the same thread.
+char const* flowValue(char const *_from, char const *_to, char const *_value) {
+    log_debug("-* flowValue(_from: '%s', _to: '%s', _value: '%s')", _from, _to, _value);
+    thread_local string output;
+    output = flowValueJson(
+        pinGraph(),
+        Address(string(_from)),
+        Address(string(_to)),
+        *_value ? Int(string(_value)) : Int::max()
+    );
+    return output.c_str();
+}
+
+/// @returns an upper bound on the max flow from @a _from to @a _to as JSON,
+/// see flowBoundJson(). Requires enableFlowIndex(), throws if no tree was
+/// built yet. It stays valid until the next call on the same thread.
+char const* flowUpperBound(char const *_from, char const *_to) {
+    log_debug("-* flowUpperBound(_from: '%s', _to: '%s')", _from, _to);
+    thread_local string output;
+    output = flowBoundJson(pinGraph(), Address(string(_from)), Address(string(_to)));
+    return output.c_str();
+}
+
+void selectFlowAlgorithm(char const *_algorithm) {
+    log_info("-* selectFlowAlgorithm(_algorithm: '%s')", _algorithm);
+    string algorithm(_algorithm);
+    if (algorithm == "edmondsKarp")
+        setFlowAlgorithm(FlowAlgorithm::EdmondsKarp);
+    else if (algorithm == "dinic")
+        setFlowAlgorithm(FlowAlgorithm::Dinic);
+    else
+        throw InvalidArgumentException();
+}
+
+void setThreadCount(int _threads) {
+    log_info("-* setThreadCount(_threads: %i)", _threads);
+    if (_threads < 1)
+        throw InvalidArgumentException();
+    ::setThreadCount(size_t(_threads));
+}
+
 size_t edgeCount() {
     log_debug("-* edgeCount()");
-    return db.edges().size();
+    return currentGraphVersion()->edgeCount;
 }
 
 void delayEdgeUpdates() {
     log_info("-* delayEdgeUpdates()");
+    lock_guard<mutex> lock(dbMutex);
     db.delayEdgeUpdates();
 }
 
 void performEdgeUpdates() {
     log_info("-> performEdgeUpdates()");
+    lock_guard<mutex> lock(dbMutex);
     db.performEdgeUpdates();
+    publishGraphVersion();
     log_info("<- performEdgeUpdates()");
 }
 
+/// Applies a batch of events, one per line, with the arguments of the
+/// functions of the same name:
+///   signup <user> <token>
+///   organizationSignup <organization>
+///   trust <canSendTo> <user> <limitPercentage>
+///   transfer <token> <from> <to> <value>
+/// The edges are updated once for the whole batch.
+/// @returns the number of events.
+size_t applyEvents(char const *_events) {
+    log_info("-> applyEvents()");
+    vector<Event> events;
+    istringstream input{string(_events)};
+    string line;
+    while (getline(input, line)) {
+        istringstream fields(line);
+        string type;
+        if (!(fields >> type))
+            continue;
+        Event event;
+        string user, token, canSendTo, from, to, value;
+        if (type == "signup") {
+            fields >> user >> token;
+            event.type = Event::Type::Signup;
+            event.user = Address(user);
+            event.token = Address(token);
+        } else if (type == "organizationSignup") {
+            fields >> user;
+            event.type = Event::Type::OrganizationSignup;
+            event.user = Address(user);
+        } else if (type == "trust") {
+            fields >> canSendTo >> user >> event.limitPercentage;
+            event.type = Event::Type::Trust;
+            event.canSendTo = Address(canSendTo);
+            event.user = Address(user);
+        } else if (type == "transfer") {
+            fields >> token >> from >> to >> value;
+            event.type = Event::Type::Transfer;
+            event.token = Address(token);
+            event.from = Address(from);
+            event.to = Address(to);
+            event.value = Int(value);
+        } else
+            throw InvalidArgumentException();
+        if (fields.fail())
+            throw InvalidArgumentException();
+        events.push_back(move(event));
+    }
+    lock_guard<mutex> lock(dbMutex);
+    try {
+        db.applyEvents(events);
+    } catch (...) {
+        // Queries should see the events that were applied before the failure.
+        publishGraphVersion();
+        throw;
+    }
+    publishGraphVersion();
+    log_info("<- applyEvents()");
+    return events.size();
+}
+
+}
+
+/// @returns the trust relations of @a _user in both directions.
+/// Has to be called with dbMutex locked.
+vector<TrustRelation> trustRelations(AddressId _user) {
+    vector<TrustRelation> relations;
+    auto addOwnTrust = [&](Safe const& _safe) {
+        for (auto const&[sendTo, percentage]: _safe.limitPercentage)
+            if (sendTo != _user)
+                relations.push_back(TrustRelation(address(sendTo), address(_user), percentage));
+    };
+    // Only the user's own safe and the safes that can send to the user are relevant,
+    // visit them in the order of the safes.
+    Safe const* userSafe = db.safeMaybe(_user);
+    for (AddressId sender: db.senders(_user)) {
+        if (userSafe && _user < sender) {
+            addOwnTrust(*userSafe);
+            userSafe = nullptr;
+        }
+        if (sender != _user)
+            relations.push_back(TrustRelation(address(_user), address(sender), db.safe(sender).sendToPercentage(_user)));
+    }
+    if (userSafe)
+        addOwnTrust(*userSafe);
+    return relations;
+}
+
+extern "C"
+{
+
 TrustRelation* adjacencies(string const& _user)
 {
     log_debug("-> adjacencies(_user: '%s')", _user.c_str());
 
-    Address user{string(_user)};
-
+    // Only looked up, so that queries for unknown addresses do not grow the table.
     auto v = new vector<TrustRelation>();
-    for (auto const& [address, safe]: db.safes) {
-        for (auto const&[sendTo, percentage]: safe.limitPercentage) {
-            if (sendTo != address && (user == address || user == sendTo)) {
-                auto a = TrustRelation(
-                        sendTo,
-                        user == sendTo ? address : user,
-                        percentage);
-
-                v->push_back(a);
-            }
-        }
+    if (optional<AddressId> user = addressTable().find(Address{string(_user)})) {
+        lock_guard<mutex> lock(dbMutex);
+        *v = trustRelations(*user);
     }
 
     log_debug("   adjacencies(_user: '%s'): Found %li adjacent nodes.", _user.c_str(), v->size());
@@ -103,72 +575,343 @@ TrustRelation* adjacencies(string const& _user)
 
 void signup(char const *_user, char const *_token) {
     log_debug("-* signup(_user: '%s', token: '%s')", &_user, &_token);
+    lock_guard<mutex> lock(dbMutex);
     db.signup(Address(string(_user)), Address(string(_token)));
+    publishGraphVersion();
 }
 
 void organizationSignup(char const *_organization) {
     log_debug("-* organizationSignup(_organization: '%s')", &_organization);
+    lock_guard<mutex> lock(dbMutex);
     db.organizationSignup(Address(string(_organization)));
+    publishGraphVersion();
 }
 
 void trust(char const *_canSendTo, char const *_user, int _limitPercentage) {
     log_debug("-* trust(_canSendTo: '%s', _user: '%s', _limitPercentage: %i)", &_canSendTo, &_user, _limitPercentage);
+    lock_guard<mutex> lock(dbMutex);
     db.trust(Address(string(_canSendTo)), Address(string(_user)), uint32_t(_limitPercentage));
+    publishGraphVersion();
 }
 
 void transfer(char const *_token, char const *_from, char const *_to, Int _value) {
     log_debug("-* transfer(_token: '%s', _from: '%s', _to: '%s', value: %s)", &_token, &_from, _to, to_string(_value).c_str());
+    lock_guard<mutex> lock(dbMutex);
     db.transfer(
             Address(string(_token)),
             Address(string(_from)),
             Address(string(_to)),
             _value
     );
+    publishGraphVersion();
 }
 }
 
-int main() {
-    loadDbFromFile("/home/daniel/src/circles-world/libpathfinder/db.dat");
 
-    auto result1 = computeFlow(
-            Address("0xDE374ece6fA50e781E81Aac78e811b33D16912c7"),
-            Address("0x4a9aFfA9249F36fd0629f342c182A4e94A13C2e0"),
-            Int("999999999999999999999999"));
+/// @returns the trust relations of @a _user as JSON, in the format of the /adjacencies endpoint.
+string adjacenciesJson(Address const& _user) {
+    vector<TrustRelation> relations;
+    if (optional<AddressId> user = addressTable().find(_user)) {
+        lock_guard<mutex> lock(dbMutex);
+        relations = trustRelations(*user);
+    }
+    string result = "[";
+    for (size_t i = 0; i < relations.size(); i++) {
+        result += i == 0 ? "{" : ",{";
+        result += "\"percentage\":" + to_string(relations[i].limit) + ",";
+        result += "\"trusts\":\"" + to_string(relations[i].to) + "\",";
+        result += "\"user\":\"" + to_string(relations[i].from) + "\"}";
+    }
+    return result + "]";
+}
 
-    auto result2 = computeFlow(
-            Address("0xDE374ece6fA50e781E81Aac78e811b33D16912c7"),
-            Address("0x42cEDde51198D1773590311E2A340DC06B24cB37"),
-            Int("999999999999999999999999"));
+/// @returns the argument @a _name of @a _request, throws if it is missing.
+string argument(map<string, string> const& _request, string const& _name) {
+    auto it = _request.find(_name);
+    if (it == _request.end())
+        throw InvalidArgumentException();
+    return jsonValueText(it->second);
+}
 
-    auto result3 = computeFlow(
-            Address("0xDE374ece6fA50e781E81Aac78e811b33D16912c7"),
-            Address("0x4a9aFfA9249F36fd0629f342c182A4e94A13C2e0"),
-            Int("999999999999999999999999"));
+/// @returns the error response to the request @a _id.
+string jsonError(string const& _id, string const& _message) {
+    return "{\"id\":" + _id + ",\"error\":" + jsonString(_message) + "}\n";
+}
 
-    auto result4 = computeFlow(
-            Address("0xDE374ece6fA50e781E81Aac78e811b33D16912c7"),
-            Address("0x42cEDde51198D1773590311E2A340DC06B24cB37"),
-            Int("999999999999999999999999"));
+/// A response that is written to stdout while it is produced, so that large
+/// responses are not held in memory at once.
+/// The response is always one line {"id":<id>,"result":<result>}. A result of
+/// up to BufferSize bytes is collected and written at once. Of a larger one,
+/// the start is written once BufferSize is exceeded and the rest as it is
+/// produced, and the output lock is held until the line is complete, so that
+/// the lines of different responses are never interleaved.
+class ResponseStream {
+public:
+    ResponseStream(mutex& _outputMutex, string _id): m_output(_outputMutex, defer_lock), m_id(move(_id)) {}
+    ResponseStream(ResponseStream const&) = delete;
+    ResponseStream& operator=(ResponseStream const&) = delete;
+
+    /// Appends @a _text to the JSON of the result. It has to end between two
+    /// values, i.e. not within a string or after a key or comma.
+    void write(string const& _text) {
+        track(_text);
+        if (m_output.owns_lock()) {
+            cout << _text;
+            return;
+        }
+        m_buffer += _text;
+        if (m_buffer.size() >= BufferSize) {
+            m_output.lock();
+            cout << "{\"id\":" << m_id << ",\"result\":" << m_buffer;
+            m_buffer.clear();
+        }
+    }
+    /// Writes the rest of the result and terminates the response.
+    void finish() {
+        if (m_output.owns_lock()) {
+            cout << "}\n" << flush;
+            m_output.unlock();
+        } else
+            writeLine("{\"id\":" + m_id + ",\"result\":" + m_buffer + "}\n");
+        m_buffer.clear();
+    }
+    /// Terminates the response with the error @a _message instead of the result.
+    /// If the start of the result is already written, it is closed and the
+    /// error is added to the same line.
+    void fail(string const& _message) {
+        if (m_output.owns_lock()) {
+            log_error("Request %s failed after the start of its result was written: %s", m_id.c_str(), _message.c_str());
+            cout << string(m_open.rbegin(), m_open.rend()) << ",\"error\":" << jsonString(_message) << "}\n" << flush;
+            m_output.unlock();
+        } else
+            writeLine(jsonError(m_id, _message));
+        m_buffer.clear();
+    }
 
-    auto result5 = computeFlow(
-            Address("0xDE374ece6fA50e781E81Aac78e811b33D16912c7"),
-            Address("0x4a9aFfA9249F36fd0629f342c182A4e94A13C2e0"),
-            Int("999999999999999999999999"));
+private:
+    static constexpr size_t BufferSize = 16 * 1024;
+
+    /// Keeps track of the objects and arrays that are open after @a _text.
+    void track(string const& _text) {
+        for (char c: _text)
+            if (m_inString) {
+                if (m_escaped)
+                    m_escaped = false;
+                else if (c == '\\')
+                    m_escaped = true;
+                else if (c == '"')
+                    m_inString = false;
+            } else if (c == '"')
+                m_inString = true;
+            else if (c == '{')
+                m_open += '}';
+            else if (c == '[')
+                m_open += ']';
+            else if ((c == '}' || c == ']') && !m_open.empty())
+                m_open.pop_back();
+    }
+    void writeLine(string const& _line) {
+        m_output.lock();
+        cout << _line << flush;
+        m_output.unlock();
+    }
+
+    unique_lock<mutex> m_output;
+    string m_id;
+    string m_buffer;
+    /// The closing brackets of the open objects and arrays, innermost last.
+    string m_open;
+    bool m_inString = false;
+    bool m_escaped = false;
+};
+
+/// Writes the response to the request @a _id to stdout, with the result that
+/// @a _handler writes to its ResponseStream or the error it throws.
+void jsonResponse(mutex& _outputMutex, string const& _id, function<void(ResponseStream&)> const& _handler) {
+    ResponseStream output(_outputMutex, _id);
+    string error;
+    try {
+        _handler(output);
+        output.finish();
+        return;
+    } catch (InvalidArgumentException const&) {
+        error = "Invalid argument";
+    } catch (Exception const&) {
+        error = "Request failed";
+    } catch (exception const& _exception) {
+        error = _exception.what();
+    }
+    output.fail(error);
+}
 
-    auto result6 = computeFlow(
-            Address("0xDE374ece6fA50e781E81Aac78e811b33D16912c7"),
-            Address("0x42cEDde51198D1773590311E2A340DC06B24cB37"),
-            Int("999999999999999999999999"));
+/// @returns the result of the read-only command @a _command of @a _request on @a _pinned,
+/// for all commands but "flow", whose result is streamed by query().
+string queryResult(string const& _command, map<string, string> const& _request, PinnedGraph const& _pinned, size_t _blockNumber) {
+    if (_command == "flowValue") {
+        Int value = _request.count("value") ? Int(argument(_request, "value")) : Int::max();
+        return flowValueJson(_pinned, Address(argument(_request, "from")), Address(argument(_request, "to")), value);
+    } else if (_command == "flowBound")
+        return flowBoundJson(_pinned, Address(argument(_request, "from")), Address(argument(_request, "to")));
+    else {
+        ArenaStatistics arena = arenaStatistics();
+        return
+            "{\"block\":" + to_string(_pinned.snapshot ? _pinned.snapshot->blockNumber() : _blockNumber) +
+            ",\"edges\":" + to_string(_pinned.edgeCount()) +
+            ",\"generation\":" + to_string(_pinned.snapshot ? 0 : _pinned.version->generation) +
+            ",\"scratch\":{\"queries\":" + to_string(arena.queries) +
+            ",\"peakBytes\":" + to_string(arena.peakBytes) +
+            ",\"meanBytes\":" + to_string(arena.queries ? arena.totalBytes / arena.queries : 0) + "}}";
+    }
+}
 
-    if (result1.flow != result3.flow)
-        log_error("Fuckup 1");
-    if (result2.flow != result4.flow)
-        log_error("Fuckup 2");
-    if (result3.flow != result5.flow)
-        log_error("Fuckup 3");
-    if (result4.flow != result6.flow)
-        log_error("Fuckup 4");
+/// Writes the result of the read-only command @a _command of @a _request on @a _pinned
+/// to @a _output. The transfers of flows are written while they are extracted.
+void query(string const& _command, map<string, string> const& _request, PinnedGraph const& _pinned, size_t _blockNumber, ResponseStream& _output) {
+    if (_command == "flow") {
+        Int value = _request.count("value") ? Int(argument(_request, "value")) : Int::max();
+        Address source(argument(_request, "from"));
+        Address sink(argument(_request, "to"));
+        writeFlowJson(_pinned, source, sink, value, [&](string const& _piece) { _output.write(_piece); });
+    } else
+        _output.write(queryResult(_command, _request, _pinned, _blockNumber));
+}
 
+/// @returns the result of the command @a _command of @a _request, which modifies the data.
+string modify(string const& _command, map<string, string> const& _request) {
+    if (_command == "loadDB")
+        return to_string(loadDbFromFile(argument(_request, "file").c_str()));
+    else if (_command == "attachSnapshot")
+        return to_string(attachSnapshot(argument(_request, "file").c_str()));
+    else if (_command == "signup")
+        signup(argument(_request, "user").c_str(), argument(_request, "token").c_str());
+    else if (_command == "organizationSignup")
+        organizationSignup(argument(_request, "organization").c_str());
+    else if (_command == "trust")
+        trust(argument(_request, "canSendTo").c_str(), argument(_request, "user").c_str(), stoi(argument(_request, "limitPercentage")));
+    else if (_command == "transfer")
+        transfer(
+            argument(_request, "token").c_str(),
+            argument(_request, "from").c_str(),
+            argument(_request, "to").c_str(),
+            Int(argument(_request, "value"))
+        );
+    else if (_command == "delayEdgeUpdates")
+        delayEdgeUpdates();
+    else if (_command == "performEdgeUpdates")
+        performEdgeUpdates();
+    else
+        throw InvalidArgumentException();
+    return "true";
+}
 
+/// Serves newline-delimited JSON requests from stdin until it is closed.
+///
+/// Each request is an object with the command in "cmd", its arguments and an
+/// optional "id", which is copied into the response. Commands that modify the
+/// data are applied in the order of the requests on the calling thread, while
+/// queries run on a pool of @a _threads workers. Queries are answered on the
+/// state as of their request, but their responses can be written out of order.
+/// Only "adjacencies" reads db directly and thus runs on the calling thread as well.
+void serveJson(size_t _threads) {
+    log_info("-> serveJson(_threads: %li)", _threads);
+
+    mutex outputMutex;
+    auto write = [&](string const& _response) {
+        lock_guard<mutex> lock(outputMutex);
+        cout << _response << flush;
+    };
+
+    // Destroyed before outputMutex, so all responses are written before returning.
+    ThreadPool workers(_threads);
+    string line;
+    while (getline(cin, line)) {
+        if (line.find_first_not_of(" \t\r") == string::npos)
+            continue;
+        map<string, string> request;
+        try {
+            request = parseFlatJsonObject(line);
+        } catch (InvalidArgumentException const&) {
+            write(jsonError("null", "Invalid request"));
+            continue;
+        }
+        string id = request.count("id") ? request["id"] : "null";
+        string command = request.count("cmd") ? jsonValueText(request["cmd"]) : "";
+
+        if (command == "flow" || command == "flowValue" || command == "flowBound" || command == "status") {
+            PinnedGraph pinned;
+            try {
+                pinned = pinGraph();
+            } catch (Exception const&) {
+                write(jsonError(id, "Request failed"));
+                continue;
+            }
+            workers.post([&outputMutex, id, command, request = move(request), pinned = move(pinned), blockNumber = dbBlockNumber.load()]() {
+                jsonResponse(outputMutex, id, [&](ResponseStream& _output) { query(command, request, pinned, blockNumber, _output); });
+            });
+        } else if (command == "adjacencies") {
+            // The trust relations are read from db, which is not versioned, so this is
+            // answered in order with the modifications instead of on a worker.
+            jsonResponse(outputMutex, id, [&](ResponseStream& _output) { _output.write(adjacenciesJson(Address(argument(request, "user")))); });
+        } else {
+            jsonResponse(outputMutex, id, [&](ResponseStream& _output) { _output.write(modify(command, request)); });
+        }
+    }
+
+    log_info("<- serveJson(_threads: %li)", _threads);
+}
+
+void printUsage() {
+    cerr << "Usage: pathfinder [--threads <n>] [--index] <mode>" << endl;
+    cerr << "Modes:" << endl;
+    cerr << "  --json [<db.dat>]                          JSON mode via stdin/stdout, see README.md." << endl;
+    cerr << "  [--flow] <from> <to> <value> <db.dat>      Compute max flow up to <value> and output transfer steps in json." << endl;
+    cerr << "Options:" << endl;
+    cerr << "  --threads <n>                              Number of threads for queries in JSON mode and for computing edges." << endl;
+    cerr << "  --index                                    Maintain the cut tree index in JSON mode (before --json)." << endl;
+}
+
+int main(int argc, char const** argv) {
+#ifdef __EMSCRIPTEN__
+    // Only used as a library.
     return 0;
-}
\ No newline at end of file
+#endif
+    vector<string> arguments(argv + 1, argv + argc);
+    size_t threads = max<size_t>(thread::hardware_concurrency(), 1);
+    if (arguments.size() >= 2 && arguments[0] == "--threads") {
+        int requested = atoi(arguments[1].c_str());
+        if (requested < 1) {
+            printUsage();
+            return 1;
+        }
+        threads = size_t(requested);
+        ::setThreadCount(threads);
+        arguments.erase(arguments.begin(), arguments.begin() + 2);
+    }
+    if (arguments.size() >= 2 && arguments[0] == "--index" && arguments[1] == "--json") {
+        enableFlowIndex();
+        arguments.erase(arguments.begin());
+    }
+    if (!arguments.empty() && arguments[0] == "--flow")
+        arguments.erase(arguments.begin());
+
+    try {
+        if (!arguments.empty() && arguments[0] == "--json" && arguments.size() <= 2) {
+            if (arguments.size() == 2)
+                loadDbFromFile(arguments[1].c_str());
+            serveJson(threads);
+        } else if (arguments.size() == 4 && arguments[0].substr(0, 2) != "--") {
+            loadDbFromFile(arguments[3].c_str());
+            writeFlowJson(pinGraph(), Address(arguments[0]), Address(arguments[1]), Int(arguments[2]), [](string const& _piece) {
+                cout << _piece;
+            });
+            cout << endl;
+        } else {
+            printUsage();
+            return 1;
+        }
+    } catch (...) {
+        log_error("Invalid arguments.");
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,55 @@
+#include "mappedFile.h"
+
+#include <fstream>
+#include <iterator>
+
+#ifndef __EMSCRIPTEN__
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+MappedFile::MappedFile(string const& _path, bool _sequential)
+{
+#ifndef __EMSCRIPTEN__
+	int fd = open(_path.c_str(), O_RDONLY);
+	if (fd < 0)
+		return;
+	struct stat info{};
+	if (fstat(fd, &info) == 0)
+	{
+		m_size = size_t(info.st_size);
+		void* mapping = m_size == 0 ? MAP_FAILED : mmap(nullptr, m_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (mapping != MAP_FAILED)
+		{
+			madvise(mapping, m_size, _sequential ? MADV_SEQUENTIAL : MADV_WILLNEED);
+			m_data = static_cast<uint8_t const*>(mapping);
+			m_open = true;
+		}
+	}
+	close(fd);
+	if (m_open)
+		return;
+	m_size = 0;
+#endif
+
+	// Fall back to reading the file (e.g. if it is empty or cannot be mapped).
+	ifstream input(_path, ios::binary);
+	if (!input.is_open())
+		return;
+	m_buffer.assign(istreambuf_iterator<char>(input), istreambuf_iterator<char>());
+	m_data = m_buffer.data();
+	m_size = m_buffer.size();
+	m_open = true;
+}
+
+MappedFile::~MappedFile()
+{
+#ifndef __EMSCRIPTEN__
+	if (m_data && m_buffer.empty())
+		munmap(const_cast<uint8_t*>(m_data), m_size);
+#endif
+}
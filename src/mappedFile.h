@@ -0,0 +1,28 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/// Read-only view of the contents of a whole file, memory-mapped where possible.
+class MappedFile
+{
+public:
+	/// @param _sequential whether the contents are read once from front to back,
+	/// otherwise they are expected to be accessed randomly and repeatedly.
+	explicit MappedFile(std::string const& _path, bool _sequential = true);
+	~MappedFile();
+	MappedFile(MappedFile const&) = delete;
+	MappedFile& operator=(MappedFile const&) = delete;
+
+	bool isOpen() const { return m_open; }
+	uint8_t const* data() const { return m_data; }
+	size_t size() const { return m_size; }
+
+private:
+	bool m_open = false;
+	uint8_t const* m_data = nullptr;
+	size_t m_size = 0;
+	/// Contents of the file if it could not be mapped.
+	std::vector<uint8_t> m_buffer;
+};
@@ -0,0 +1,68 @@
+#include "parallel.h"
+
+#include <atomic>
+
+/// Atomic, since it can be changed while queries run.
+static std::atomic<size_t> _threadCount{1};
+
+void setThreadCount(size_t _threads)
+{
+	_threadCount = std::max<size_t>(_threads, 1);
+}
+
+size_t threadCount()
+{
+	return _threadCount;
+}
+
+ThreadPool::ThreadPool(size_t _threads)
+{
+#ifdef __EMSCRIPTEN__
+	_threads = 0;
+#endif
+	for (size_t i = 0; i < _threads; i++)
+		m_workers.emplace_back([this]() { work(); });
+}
+
+ThreadPool::~ThreadPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_stopping = true;
+	}
+	m_condition.notify_all();
+	for (std::thread& worker: m_workers)
+		worker.join();
+}
+
+void ThreadPool::post(std::function<void()> _task)
+{
+	if (m_workers.empty())
+	{
+		_task();
+		return;
+	}
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_tasks.push_back(std::move(_task));
+	}
+	m_condition.notify_one();
+}
+
+void ThreadPool::work()
+{
+	while (true)
+	{
+		std::function<void()> task;
+		{
+			std::unique_lock<std::mutex> lock(m_mutex);
+			m_condition.wait(lock, [&]() { return m_stopping || !m_tasks.empty(); });
+			// Only stop once all tasks are done.
+			if (m_tasks.empty())
+				return;
+			task = std::move(m_tasks.front());
+			m_tasks.pop_front();
+		}
+		task();
+	}
+}
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/// Number of threads used for work that can be split up, one by default.
+void setThreadCount(size_t _threads);
+size_t threadCount();
+
+/// Splits the range [0, @a _count) into at most @a _threads contiguous parts and
+/// calls `_body(begin, end)` for each of them concurrently.
+/// Parts get at least @a _minPerThread items, so small ranges (and builds
+/// without thread support) just run on the calling thread.
+/// @a _body must not throw.
+template <class Body>
+void parallelFor(size_t _count, size_t _threads, Body const& _body, size_t _minPerThread = 1024)
+{
+#ifdef __EMSCRIPTEN__
+	_threads = 1;
+#endif
+	_threads = std::min(_threads, std::max<size_t>(_count / _minPerThread, 1));
+	if (_threads <= 1)
+	{
+		_body(size_t(0), _count);
+		return;
+	}
+
+	std::vector<std::thread> workers;
+	for (size_t i = 1; i < _threads; i++)
+		workers.emplace_back([&, i]() { _body(_count * i / _threads, _count * (i + 1) / _threads); });
+	_body(size_t(0), _count / _threads);
+	for (std::thread& worker: workers)
+		worker.join();
+}
+
+/// Fixed set of worker threads that run tasks in the order they are posted.
+/// The destructor waits for all posted tasks to finish.
+/// Without thread support (or with zero threads), tasks run on the posting thread.
+class ThreadPool
+{
+public:
+	explicit ThreadPool(size_t _threads);
+	~ThreadPool();
+	ThreadPool(ThreadPool const&) = delete;
+	ThreadPool& operator=(ThreadPool const&) = delete;
+
+	/// Schedules @a _task to run on one of the workers. @a _task must not throw.
+	void post(std::function<void()> _task);
+	size_t size() const { return m_workers.size(); }
+
+private:
+	void work();
+
+	std::mutex m_mutex;
+	std::condition_variable m_condition;
+	std::deque<std::function<void()>> m_tasks;
+	bool m_stopping = false;
+	std::vector<std::thread> m_workers;
+};
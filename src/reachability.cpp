@@ -0,0 +1,126 @@
+#include "reachability.h"
+
+#include <algorithm>
+
+using namespace std;
+
+ReachabilityIndex::ReachabilityIndex(FlowGraphView const& _graph)
+{
+	static constexpr uint32_t Unvisited = uint32_t(-1);
+	// Iterative version of Tarjan's algorithm. It completes the components
+	// in reverse topological order, `component` is that completion index.
+	size_t nodeCount = _graph.nodeCount;
+	vector<uint32_t> component(nodeCount, Unvisited);
+	vector<uint32_t> index(nodeCount, Unvisited);
+	vector<uint32_t> lowLink(nodeCount, 0);
+	vector<NodeId> stack;
+	/// Depth-first search path, with the next arc to look at for each node.
+	vector<pair<NodeId, ArcId>> path;
+	uint32_t nextIndex = 0;
+	uint32_t componentCount = 0;
+
+	for (NodeId root = 0; root < nodeCount; root++)
+	{
+		if (index[root] != Unvisited)
+			continue;
+		index[root] = lowLink[root] = nextIndex++;
+		stack.push_back(root);
+		path.emplace_back(root, _graph.begin(root));
+		while (!path.empty())
+		{
+			auto& [node, arc] = path.back();
+			if (arc < _graph.end(node))
+			{
+				NodeId target = _graph.targets[arc];
+				bool positive = Int(0) < _graph.capacities[arc];
+				arc++;
+				if (!positive)
+					continue;
+				if (index[target] == Unvisited)
+				{
+					index[target] = lowLink[target] = nextIndex++;
+					stack.push_back(target);
+					// Invalidates node and arc.
+					path.emplace_back(target, _graph.begin(target));
+				}
+				else if (component[target] == Unvisited)
+					lowLink[node] = min(lowLink[node], index[target]);
+				continue;
+			}
+			NodeId finished = node;
+			path.pop_back();
+			if (lowLink[finished] == index[finished])
+			{
+				NodeId member;
+				do
+				{
+					member = stack.back();
+					stack.pop_back();
+					component[member] = componentCount;
+				}
+				while (member != finished);
+				componentCount++;
+			}
+			if (!path.empty())
+				lowLink[path.back().first] = min(lowLink[path.back().first], lowLink[finished]);
+		}
+	}
+
+	m_order.resize(nodeCount);
+	for (NodeId node = 0; node < nodeCount; node++)
+		m_order[node] = componentCount - 1 - component[node];
+
+	// Condensation, possibly with duplicate arcs.
+	vector<pair<uint32_t, uint32_t>> dagArcs;
+	for (NodeId node = 0; node < nodeCount; node++)
+		for (ArcId arc = _graph.begin(node); arc < _graph.end(node); arc++)
+			if (Int(0) < _graph.capacities[arc] && m_order[node] != m_order[_graph.targets[arc]])
+				dagArcs.emplace_back(m_order[node], m_order[_graph.targets[arc]]);
+	sort(dagArcs.begin(), dagArcs.end());
+	dagArcs.erase(unique(dagArcs.begin(), dagArcs.end()), dagArcs.end());
+	m_dagBegin.assign(size_t(componentCount) + 1, 0);
+	for (auto const& [from, to]: dagArcs)
+		m_dagBegin[from + 1]++;
+	for (size_t i = 0; i < componentCount; i++)
+		m_dagBegin[i + 1] += m_dagBegin[i];
+	m_dagTargets.reserve(dagArcs.size());
+	for (auto const& [from, to]: dagArcs)
+		m_dagTargets.push_back(to);
+}
+
+bool ReachabilityIndex::reachable(NodeId _source, NodeId _sink) const
+{
+	uint32_t from = m_order[_source];
+	uint32_t to = m_order[_sink];
+	if (from == to)
+		return true;
+	if (from > to)
+		return false;
+
+	// Search the part of the condensation between the two components.
+	// The visited marks are per thread and reset by a stamp.
+	thread_local vector<uint32_t> visited;
+	thread_local uint32_t stamp = 0;
+	if (visited.size() < componentCount())
+		visited.resize(componentCount(), 0);
+	if (++stamp == 0)
+	{
+		fill(visited.begin(), visited.end(), 0);
+		stamp = 1;
+	}
+	vector<uint32_t> queue{from};
+	visited[from] = stamp;
+	for (size_t head = 0; head < queue.size(); head++)
+		for (uint32_t i = m_dagBegin[queue[head]]; i < m_dagBegin[queue[head] + 1]; i++)
+		{
+			uint32_t target = m_dagTargets[i];
+			if (target == to)
+				return true;
+			if (target < to && visited[target] != stamp)
+			{
+				visited[target] = stamp;
+				queue.push_back(target);
+			}
+		}
+	return false;
+}
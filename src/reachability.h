@@ -0,0 +1,32 @@
+#pragma once
+
+#include "flowGraph.h"
+
+/// Strongly connected components of the arcs with positive capacity of a
+/// flow graph, condensed into a DAG and numbered in topological order.
+///
+/// Nodes can only reach nodes whose component comes at the same position or
+/// later, so most pairs without a path between them are rejected by comparing
+/// two numbers, and every node on a path between two nodes lies in the range
+/// of positions between theirs.
+class ReachabilityIndex
+{
+public:
+	/// Builds the index of @a _graph in linear time.
+	explicit ReachabilityIndex(FlowGraphView const& _graph);
+
+	/// @returns the topological position of the component of @a _node.
+	uint32_t order(NodeId _node) const { return m_order[_node]; }
+
+	/// @returns true if @a _sink can be reached from @a _source along arcs with positive capacity.
+	bool reachable(NodeId _source, NodeId _sink) const;
+
+	size_t componentCount() const { return m_dagBegin.size() - 1; }
+
+private:
+	/// Node to the topological position of its component.
+	std::vector<uint32_t> m_order;
+	/// Arcs between the components (by position) in compressed sparse row form.
+	std::vector<uint32_t> m_dagBegin;
+	std::vector<uint32_t> m_dagTargets;
+};
@@ -0,0 +1,115 @@
+#include "sharedSnapshot.h"
+
+#include "binaryExporter.h"
+#include "binaryImporter.h"
+#include "exceptions.h"
+#include "log.h"
+
+#include <cstdio>
+#include <fstream>
+#include <optional>
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace std;
+
+/// @returns the device and inode of the file at @a _path, which change when it is replaced,
+/// or nothing if it does not exist (e.g. while it is being replaced by hand).
+static optional<pair<uint64_t, uint64_t>> fileId(string const& _path)
+{
+	struct stat info{};
+	if (stat(_path.c_str(), &info) != 0)
+		return nullopt;
+	return pair<uint64_t, uint64_t>{uint64_t(info.st_dev), uint64_t(info.st_ino)};
+}
+
+SharedSnapshot::SharedSnapshot(string const& _path):
+	m_file(_path, false)
+{
+	log_debug("-> SharedSnapshot(_path: '%s')", _path.c_str());
+	require(m_file.isOpen());
+	m_blockNumber = BinaryImporter(m_file.data(), m_file.size()).readMappedFlowGraph(m_graph, m_nodes, m_addressNodes, m_tokenOwners);
+	m_edgeCount = m_graph.edgeCount();
+	m_reachability = make_unique<ReachabilityIndex const>(m_graph);
+	m_graph.reachability = m_reachability.get();
+	log_debug("<- SharedSnapshot(_path: '%s')", _path.c_str());
+}
+
+SharedSnapshotReader::SharedSnapshotReader(string _path):
+	m_path(move(_path))
+{
+	// If the file is replaced in between, the next refresh maps it again.
+	optional<pair<uint64_t, uint64_t>> id = fileId(m_path);
+	require(id);
+	m_fileId = *id;
+	m_lastCheck = chrono::steady_clock::now().time_since_epoch().count();
+	m_current = make_shared<SharedSnapshot const>(m_path);
+}
+
+bool SharedSnapshotReader::refresh()
+{
+	// Called by every query, which should neither wait for each other nor
+	// each stat the file: Only one thread checks it once the interval is over.
+	auto now = chrono::steady_clock::now().time_since_epoch();
+	if (now.count() - m_lastCheck.load(memory_order_relaxed) < chrono::steady_clock::duration(CheckInterval).count())
+		return false;
+	unique_lock<mutex> lock(m_mutex, try_to_lock);
+	if (!lock.owns_lock())
+		return false;
+	m_lastCheck = now.count();
+
+	optional<pair<uint64_t, uint64_t>> id = fileId(m_path);
+	if (!id)
+	{
+		log_warn("Could not check '%s', staying at block %li", m_path.c_str(), atomic_load(&m_current)->blockNumber());
+		return false;
+	}
+	if (*id == m_fileId)
+		return false;
+
+	log_info("-> SharedSnapshotReader::refresh(): '%s' was replaced", m_path.c_str());
+	shared_ptr<SharedSnapshot const> snapshot;
+	try
+	{
+		snapshot = make_shared<SharedSnapshot const>(m_path);
+	}
+	catch (Exception const&)
+	{
+		// m_fileId is kept, so it is tried again after the next interval.
+		log_error("Could not map '%s', staying at block %li", m_path.c_str(), atomic_load(&m_current)->blockNumber());
+		return false;
+	}
+	m_fileId = *id;
+	atomic_store(&m_current, move(snapshot));
+	log_info("<- SharedSnapshotReader::refresh(): now at block %li", atomic_load(&m_current)->blockNumber());
+	return true;
+}
+
+bool publishSnapshot(string const& _path, size_t _blockNumber, DB const& _db)
+{
+	log_debug("-> publishSnapshot(_path: '%s', _blockNumber: %li)", _path.c_str(), _blockNumber);
+	require(!_db.hasPendingEdgeUpdates());
+
+	string temporary = _path + ".tmp" + to_string(getpid());
+	{
+		ofstream output(temporary, ios::binary);
+		if (output.is_open())
+			BinaryExporter(output).write(_blockNumber, _db);
+		if (!output.is_open() || !output.flush())
+		{
+			log_error("Could not write '%s'", temporary.c_str());
+			remove(temporary.c_str());
+			return false;
+		}
+	}
+	if (rename(temporary.c_str(), _path.c_str()) != 0)
+	{
+		log_error("Could not rename '%s' to '%s'", temporary.c_str(), _path.c_str());
+		remove(temporary.c_str());
+		return false;
+	}
+
+	log_debug("<- publishSnapshot(_path: '%s', _blockNumber: %li)", _path.c_str(), _blockNumber);
+	return true;
+}
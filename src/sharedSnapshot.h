@@ -0,0 +1,93 @@
+#pragma once
+
+#include "flowGraph.h"
+#include "mappedFile.h"
+#include "reachability.h"
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+struct DB;
+
+/// Flow graph of a snapshot file (see BinaryExporter) that is queried directly
+/// from the mapped file instead of being loaded into a DB.
+///
+/// The arc arrays, which make up almost all of the graph, stay in the file,
+/// so processes that map the same file (e.g. in /dev/shm) share their memory.
+/// Only the nodes are copied, since they refer to the global address table,
+/// the token owners are extracted from the safes and the reachability index
+/// is built.
+class SharedSnapshot
+{
+public:
+	/// Maps the snapshot at @a _path.
+	/// Throws if it cannot be read or does not contain a flow graph.
+	explicit SharedSnapshot(std::string const& _path);
+	SharedSnapshot(SharedSnapshot const&) = delete;
+	SharedSnapshot& operator=(SharedSnapshot const&) = delete;
+
+	size_t blockNumber() const { return m_blockNumber; }
+	/// The graph, which can be passed to computeFlow().
+	FlowGraphView const& graph() const { return m_graph; }
+	/// Token address to the safe that issued it (Zero if unknown).
+	std::vector<AddressId> const& tokenOwners() const { return m_tokenOwners; }
+	/// Number of edges of the trust graph.
+	size_t edgeCount() const { return m_edgeCount; }
+
+private:
+	MappedFile m_file;
+	size_t m_blockNumber = 0;
+	FlowGraphView m_graph;
+	std::vector<FlowGraphNode> m_nodes;
+	std::vector<NodeId> m_addressNodes;
+	std::vector<AddressId> m_tokenOwners;
+	size_t m_edgeCount = 0;
+	std::unique_ptr<ReachabilityIndex const> m_reachability;
+};
+
+/// Follows the snapshots published under a path by publishSnapshot().
+///
+/// Queries pin the current snapshot via current() and keep using it even if
+/// a newer one is swapped in by refresh() in the meantime. The file of an
+/// old snapshot is unmapped once the last query using it is done.
+class SharedSnapshotReader
+{
+public:
+	/// Maps the snapshot at @a _path, throws if that fails.
+	explicit SharedSnapshotReader(std::string _path);
+
+	/// Maps the file at the path again if it has been replaced since it was last mapped.
+	/// The file is checked at most once per CheckInterval, other calls return
+	/// right away, as do calls while another thread is refreshing. If the file
+	/// cannot be checked or mapped, the current snapshot stays in use.
+	/// Can be called concurrently with current() and with itself.
+	/// @returns true if a new snapshot was swapped in.
+	bool refresh();
+
+	/// @returns the most recent snapshot, which stays valid as long as the pointer is held.
+	std::shared_ptr<SharedSnapshot const> current() const { return std::atomic_load(&m_current); }
+
+	/// Minimum time between two checks of the file by refresh().
+	static constexpr std::chrono::milliseconds CheckInterval{100};
+
+private:
+	std::string m_path;
+	/// Held by the thread that is refreshing.
+	std::mutex m_mutex;
+	/// Time of the last check of the file, in steady_clock ticks.
+	std::atomic<std::chrono::steady_clock::rep> m_lastCheck{0};
+	/// Device and inode of the file of the current snapshot.
+	std::pair<uint64_t, uint64_t> m_fileId;
+	std::shared_ptr<SharedSnapshot const> m_current;
+};
+
+/// Writes a snapshot of @a _db at @a _blockNumber to @a _path, such that readers
+/// never see a partially written file: It is written next to @a _path first and
+/// then renamed, which replaces the previous snapshot atomically.
+/// Throws if there are pending edge updates, since readers need the flow graph.
+/// @returns false if the file could not be written.
+bool publishSnapshot(std::string const& _path, size_t _blockNumber, DB const& _db);
@@ -4,15 +4,69 @@
 #include "keccak.h"
 #include "encoding.h"
 
+#include <mutex>
+
+// Add and subtract with carry: The intrinsics exist in all x86-64 compilers.
+// PATHFINDER_NO_INTRINSICS selects the fallbacks, so that they can be tested.
+#if defined(__x86_64__) && !defined(PATHFINDER_NO_INTRINSICS)
+#include <x86intrin.h>
+#define HAVE_X86_ADDCARRY 1
+#endif
+
 using namespace std;
 
 
-Int timesTen(Int const& _value)
+#ifdef __SIZEOF_INT128__
+__extension__ typedef unsigned __int128 UInt128;
+#endif
+
+/// Decimal conversion works on chunks of this many digits, the most that fit
+/// in a word (or, without 128 bit arithmetic, that can be multiplied or
+/// divided by via the 32 bit operators).
+#ifdef __SIZEOF_INT128__
+static constexpr size_t ChunkDigits = 19;
+static constexpr uint64_t ChunkBase = 10000000000000000000u;
+#else
+static constexpr size_t ChunkDigits = 9;
+static constexpr uint64_t ChunkBase = 1000000000;
+#endif
+
+/// Sets @a _value to `_value * ChunkBase + _chunk` (modulo 2^256).
+void appendChunk(Int& _value, uint64_t _chunk)
 {
-	Int timesTwo = _value + _value;
-	Int timesFour = timesTwo + timesTwo;
-	Int timesEight = timesFour + timesFour;
-	return timesEight + timesTwo;
+#ifdef __SIZEOF_INT128__
+	uint64_t carry = _chunk;
+	for (size_t i = 0; i < 4; i++)
+	{
+		UInt128 x = UInt128(_value.data[i]) * ChunkBase + carry;
+		_value.data[i] = uint64_t(x);
+		carry = uint64_t(x >> 64);
+	}
+#else
+	_value = _value * uint32_t(ChunkBase) + Int(_chunk);
+#endif
+}
+
+/// Divides @a _value by ChunkBase.
+/// @returns the remainder.
+uint64_t removeChunk(Int& _value)
+{
+#ifdef __SIZEOF_INT128__
+	uint64_t remainder = 0;
+	for (size_t i = _value.data[3] ? 4 : _value.data[2] ? 3 : _value.data[1] ? 2 : 1; i-- > 0;)
+	{
+		UInt128 x = (UInt128(remainder) << 64) | _value.data[i];
+		uint64_t quotient = uint64_t(x / ChunkBase);
+		remainder = _value.data[i] - quotient * ChunkBase;
+		_value.data[i] = quotient;
+	}
+	return remainder;
+#else
+	Int quotient = _value / uint32_t(ChunkBase);
+	uint64_t remainder = (_value - quotient * uint32_t(ChunkBase)).data[0];
+	_value = quotient;
+	return remainder;
+#endif
 }
 
 Int::Int(uint64_t _value)
@@ -32,37 +86,92 @@ Int::Int(string const& _value): Int(0)
 			data[bit / 64] |= uint64_t(fromHex(_value[i])) << (bit % 64);
 		}
 	else
-		for (char c: _value)
+	{
+		// The first chunk takes the digits that do not fill a whole chunk.
+		size_t chunkEnd = _value.size() % ChunkDigits;
+		if (chunkEnd == 0)
+			chunkEnd = ChunkDigits;
+		for (size_t i = 0; i < _value.size(); chunkEnd += ChunkDigits)
 		{
-			*this = timesTen(*this);
-			require('0' <= c && c <= '9');
-			*this += Int(uint64_t(c - '0'));
+			uint64_t chunk = 0;
+			for (; i < chunkEnd && i < _value.size(); i++)
+			{
+				require('0' <= _value[i] && _value[i] <= '9');
+				chunk = chunk * 10 + uint64_t(_value[i] - '0');
+			}
+			appendChunk(*this, chunk);
 		}
+	}
+}
+
+/// @returns @a _a + @a _b + @a _carry and sets @a _carry to the carry out (0 or 1).
+inline uint64_t addWithCarry(uint64_t _a, uint64_t _b, uint64_t& _carry)
+{
+#if defined(HAVE_X86_ADDCARRY)
+	unsigned long long sum = 0;
+	_carry = _addcarry_u64(static_cast<unsigned char>(_carry), _a, _b, &sum);
+	return sum;
+#elif defined(__SIZEOF_INT128__)
+	UInt128 sum = UInt128(_a) + _b + _carry;
+	_carry = uint64_t(sum >> 64);
+	return uint64_t(sum);
+#else
+	uint64_t sum = _a + _b;
+	uint64_t carry = sum < _a;
+	sum += _carry;
+	_carry = carry | (sum < _carry);
+	return sum;
+#endif
+}
+
+/// @returns @a _a - @a _b - @a _borrow and sets @a _borrow to the borrow out (0 or 1).
+inline uint64_t subtractWithBorrow(uint64_t _a, uint64_t _b, uint64_t& _borrow)
+{
+#if defined(HAVE_X86_ADDCARRY)
+	unsigned long long difference = 0;
+	_borrow = _subborrow_u64(static_cast<unsigned char>(_borrow), _a, _b, &difference);
+	return difference;
+#elif defined(__SIZEOF_INT128__)
+	UInt128 difference = UInt128(_a) - _b - _borrow;
+	_borrow = uint64_t(difference >> 64) & 1;
+	return uint64_t(difference);
+#else
+	uint64_t difference = _a - _b;
+	uint64_t borrow = _a < _b;
+	borrow |= difference < _borrow;
+	difference -= _borrow;
+	_borrow = borrow;
+	return difference;
+#endif
 }
 
 Int& Int::operator+=(Int const& _other)
 {
+	// Unrolled, so that the carry stays in the flags.
 	uint64_t carry = 0;
-	for (size_t i = 0; i < 4; i++)
-	{
-		uint64_t newCarry = 0;
-		uint64_t x = data[i] + _other.data[i];
-		if (x < data[i] || x + carry < x)
-			newCarry = 1;
-		data[i] = x + carry;
-		carry = newCarry;
-	}
+	data[0] = addWithCarry(data[0], _other.data[0], carry);
+	data[1] = addWithCarry(data[1], _other.data[1], carry);
+	data[2] = addWithCarry(data[2], _other.data[2], carry);
+	data[3] = addWithCarry(data[3], _other.data[3], carry);
 	// TODO: overflow if carry is nonzero.
 	// TOOD but this clashes with subtraction.
 	return *this;
 }
 
+Int& Int::operator-=(Int const& _other)
+{
+	// Wraps around like adding the two's complement.
+	uint64_t borrow = 0;
+	data[0] = subtractWithBorrow(data[0], _other.data[0], borrow);
+	data[1] = subtractWithBorrow(data[1], _other.data[1], borrow);
+	data[2] = subtractWithBorrow(data[2], _other.data[2], borrow);
+	data[3] = subtractWithBorrow(data[3], _other.data[3], borrow);
+	return *this;
+}
+
 Int Int::operator-() const
 {
-	Int x = *this;
-	for (size_t i = 0; i < 4; i++)
-		x.data[i] = ~x.data[i];
-	return x + Int(1);
+	return Int(0) - *this;
 }
 
 Int Int::half() const
@@ -91,35 +200,57 @@ Int Int::timesTwo() const
 
 Int Int::operator*(uint32_t _other) const
 {
+	// Multiplies word by word, the product of a word and a 32 bit factor
+	// plus the carry always fits in 96 bits.
 	Int result;
-	Int shifted = *this;
-	while (_other > 0)
+#ifdef __SIZEOF_INT128__
+	if ((data[1] | data[2] | data[3]) == 0)
 	{
-		if (_other & 1)
-			result += shifted;
-		shifted = shifted.timesTwo();
-		_other >>= 1;
+		UInt128 product = static_cast<UInt128>(data[0]) * _other;
+		result.data[0] = uint64_t(product);
+		result.data[1] = uint64_t(product >> 64);
+		return result;
 	}
+	uint64_t carry = 0;
+	for (size_t i = 0; i < 4; i++)
+	{
+		UInt128 product = static_cast<UInt128>(data[i]) * _other + carry;
+		result.data[i] = uint64_t(product);
+		carry = uint64_t(product >> 64);
+	}
+#else
+	uint64_t carry = 0;
+	for (size_t i = 0; i < 4; i++)
+	{
+		uint64_t low = (data[i] & 0xffffffff) * _other + (carry & 0xffffffff);
+		uint64_t high = (data[i] >> 32) * _other + (carry >> 32) + (low >> 32);
+		result.data[i] = (high << 32) | (low & 0xffffffff);
+		carry = high >> 32;
+	}
+#endif
 	return result;
 }
 
 Int Int::operator/(uint32_t _other) const
 {
 	require(_other != 0);
-	Int n = *this;
-	Int quotient{};
-	uint64_t remainder = 0;
+	Int quotient;
+	if ((data[1] | data[2] | data[3]) == 0)
+	{
+		quotient.data[0] = data[0] / _other;
+		return quotient;
+	}
 
-	for (int i = 255; i >= 0; i--)
+	// Long division in 32 bit digits: The remainder is below the divisor, so
+	// the remainder followed by the next digit fits in 64 bits.
+	uint64_t remainder = 0;
+	for (size_t i = data[3] ? 4 : data[2] ? 3 : 2; i-- > 0;)
 	{
-		remainder <<= 1;
-		if (n.data[i / 64] & (uint64_t(1) << (i % 64)))
-			remainder++;
-		if (remainder >= _other)
-		{
-			remainder -= _other;
-			quotient.data[i / 64] |= uint64_t(1) << (i % 64);
-		}
+		uint64_t high = (remainder << 32) | (data[i] >> 32);
+		remainder = high % _other;
+		uint64_t low = (remainder << 32) | (data[i] & 0xffffffff);
+		remainder = low % _other;
+		quotient.data[i] = ((high / _other) << 32) | (low / _other);
 	}
 	return quotient;
 }
@@ -134,35 +265,39 @@ Int Int::max()
 
 string to_string(Int _value)
 {
-	static vector<Int> powersOfTen;
-	if (powersOfTen.empty())
+	static char const digitPairs[] =
+		"00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+		"40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+		"8081828384858687888990919293949596979899";
+
+	// At most 78 digits, written from the end.
+	char buffer[80];
+	char* end = buffer + sizeof(buffer);
+	char* begin = end;
+	do
 	{
-		Int x{1};
-		while (true)
+		uint64_t chunk = removeChunk(_value);
+		bool last = _value == Int(0);
+		char* chunkEnd = begin;
+		for (; chunk >= 100; chunk /= 100)
 		{
-			powersOfTen.push_back(x);
-			Int next = timesTen(x);
-			if (next < x)
-				break;
-			x = move(next);
+			begin -= 2;
+			memcpy(begin, digitPairs + 2 * (chunk % 100), 2);
 		}
-	}
-
-	string result;
-	for (size_t i = 0; i < powersOfTen.size(); i++)
-	{
-		Int const& pt = powersOfTen[powersOfTen.size() - i - 1];
-		size_t digit = 0;
-		while (_value >= pt)
+		if (chunk >= 10)
 		{
-			_value -= pt;
-			digit++;
+			begin -= 2;
+			memcpy(begin, digitPairs + 2 * chunk, 2);
 		}
-		if (digit != 0 || !result.empty())
-			result.push_back('0' + digit);
+		else if (chunk > 0 || !last)
+			*--begin = char('0' + chunk);
+		// Chunks below the most significant one are padded with zeros.
+		if (!last)
+			while (begin > chunkEnd - ChunkDigits)
+				*--begin = '0';
 	}
-	require(_value == Int(0));
-	return result.empty() ? "0" : result;
+	while (_value != Int(0));
+	return begin == end ? "0" : string(begin, end);
 }
 
 Address::Address(string const& _hex)
@@ -182,6 +317,41 @@ Address::Address(string const& _hex)
 	}
 }
 
+AddressId AddressTable::intern(Address const& _address)
+{
+	if (optional<AddressId> id = find(_address))
+		return *id;
+
+	unique_lock<shared_mutex> lock(m_mutex);
+	auto it = m_ids.find(_address);
+	if (it != m_ids.end())
+		return it->second;
+	size_t id = m_size.load(memory_order_relaxed);
+	require(id < AddressId(-1));
+	auto [chunk, index] = location(AddressId(id));
+	if (!m_chunks[chunk])
+		m_chunks[chunk] = make_unique<Address[]>(FirstChunkSize << chunk);
+	m_chunks[chunk][index] = _address;
+	m_ids.emplace(_address, AddressId(id));
+	m_size.store(id + 1, memory_order_release);
+	return AddressId(id);
+}
+
+optional<AddressId> AddressTable::find(Address const& _address) const
+{
+	shared_lock<shared_mutex> lock(m_mutex);
+	auto it = m_ids.find(_address);
+	if (it == m_ids.end())
+		return nullopt;
+	return it->second;
+}
+
+AddressTable& addressTable()
+{
+	static AddressTable table;
+	return table;
+}
+
 string to_string(Address const& _address)
 {
 	string lower;
@@ -8,6 +8,13 @@
 #include <iostream>
 #include <array>
 #include <variant>
+#include <optional>
+#include <unordered_map>
+#include <cstring>
+#include <atomic>
+#include <memory>
+#include <shared_mutex>
+#include <stdexcept>
 
 
 struct Int
@@ -26,11 +33,13 @@ struct Int
 		return x;
 	}
 	Int operator-() const;
-	Int& operator-=(Int const& _other)
+	Int& operator-=(Int const& _other);
+	Int operator-(Int const& _other) const
 	{
-		return (*this) += -_other;
+		Int x = *this;
+		x -= _other;
+		return x;
 	}
-	Int operator-(Int const& _other) const { return (*this) + (-_other); }
 	Int operator*(uint32_t _other) const;
 	Int& operator*=(uint32_t _other) { return *this = *this * _other; }
 	Int operator/(uint32_t _other) const;
@@ -78,6 +87,76 @@ struct Address
 std::string to_string(Address const& _address);
 inline std::ostream& operator<<(std::ostream& os, Address const& _address) { return os << to_string(_address); }
 
+namespace std
+{
+template <> struct hash<Address>
+{
+	size_t operator()(Address const& _address) const
+	{
+		// Addresses are hashes already, so any part of them is a good hash.
+		size_t h;
+		memcpy(&h, _address.address.data(), sizeof(h));
+		return h;
+	}
+};
+}
+
+/// Handle of an address interned in the AddressTable.
+using AddressId = uint32_t;
+
+/// Interns each address once and hands out a dense and stable handle for it,
+/// so that the rest of the code can key its containers by a 32-bit integer
+/// instead of the full address.
+/// The zero address is always interned with the handle `AddressTable::Zero`.
+///
+/// All functions can be called concurrently. Looking up the address of a handle,
+/// which flow queries do a lot, does not even lock.
+class AddressTable
+{
+public:
+	static constexpr AddressId Zero = 0;
+
+	AddressTable() { intern(Address{}); }
+
+	/// @returns the handle of @a _address, interning it if it is not yet known.
+	AddressId intern(Address const& _address);
+	/// @returns the handle of @a _address if it is known.
+	std::optional<AddressId> find(Address const& _address) const;
+	Address const& address(AddressId _id) const
+	{
+		if (_id >= size())
+			throw std::out_of_range("Unknown address handle.");
+		auto [chunk, index] = location(_id);
+		return m_chunks[chunk][index];
+	}
+	size_t size() const { return m_size.load(std::memory_order_acquire); }
+
+private:
+	/// Size of the first chunk, each further chunk is twice as large as the previous one.
+	static constexpr size_t FirstChunkSize = 1024;
+
+	/// @returns the chunk of @a _id and its index in there.
+	static std::pair<size_t, size_t> location(AddressId _id)
+	{
+		// Chunk c starts at handle FirstChunkSize * (2^c - 1).
+		size_t chunk = size_t(63 - __builtin_clzll(uint64_t(_id / FirstChunkSize + 1)));
+		return {chunk, _id - FirstChunkSize * ((size_t(1) << chunk) - 1)};
+	}
+
+	/// The addresses by handle, in chunks that are never moved, so that
+	/// they can be read while new addresses are added.
+	std::unique_ptr<Address[]> m_chunks[32];
+	/// Number of interned addresses, only increased once an address is stored.
+	std::atomic<size_t> m_size{0};
+	std::unordered_map<Address, AddressId> m_ids;
+	/// Protects m_ids and the interning of new addresses.
+	mutable std::shared_mutex m_mutex;
+};
+
+/// @returns the process-wide address table.
+AddressTable& addressTable();
+inline Address const& address(AddressId _id) { return addressTable().address(_id); }
+
 struct Connection
 {
 	Address canSendToAddress;
@@ -108,9 +187,9 @@ struct TrustRelation {
 
 struct Edge
 {
-	Address from;
-	Address to;
-	Address token;
+	AddressId from;
+	AddressId to;
+	AddressId token;
 	Int capacity;
 
 	bool operator<(Edge const& _other) const
@@ -121,18 +200,16 @@ struct Edge
 	}
 };
 
+/// Max flow and the transfers that realize it.
 struct Flow {
     Int flow;
-    Edge *edges;
+    std::vector<Edge> edges;
     Flow() {}
-    explicit Flow(Int flow, std::vector<Edge> edges) {
-        this->flow = flow;
-        this->edges = edges.data();
-    };
+    explicit Flow(Int flow, std::vector<Edge> edges): flow(flow), edges(std::move(edges)) {}
 };
 
 
 /// Node in the flow Graph.
 /// Either an actual node, or a newly introduced node on a token edge.
-using FlowGraphNode = std::variant<Address, std::tuple<Address, Address>>;
+using FlowGraphNode = std::variant<AddressId, std::tuple<AddressId, AddressId>>;
 
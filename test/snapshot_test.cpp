@@ -0,0 +1,135 @@
+/// Checks that snapshots with an inconsistent flow graph are rejected:
+/// Writes a snapshot of a small DB, redirects a reverse arc into the arcs of
+/// another node than its target and expects both ways of loading the snapshot
+/// to throw, while the unmodified snapshot loads.
+
+#include "binaryExporter.h"
+#include "binaryImporter.h"
+#include "db.h"
+#include "exceptions.h"
+
+#include <cstdio>
+#include <cstring>
+#include <sstream>
+
+using namespace std;
+
+template <class T>
+T readAt(string const& _data, size_t _offset)
+{
+	T value;
+	memcpy(&value, _data.data() + _offset, sizeof(T));
+	return value;
+}
+
+template <class T>
+void writeAt(string& _data, size_t _offset, T _value)
+{
+	memcpy(_data.data() + _offset, &_value, sizeof(T));
+}
+
+/// @returns true if both BinaryImporter::readBlockNumberAndDB and
+/// BinaryImporter::readMappedFlowGraph accept @a _snapshot.
+bool loads(string const& _snapshot)
+{
+	auto const* data = reinterpret_cast<uint8_t const*>(_snapshot.data());
+	try
+	{
+		BinaryImporter(data, _snapshot.size()).readBlockNumberAndDB();
+	}
+	catch (Exception const&)
+	{
+		return false;
+	}
+	FlowGraphView graph;
+	vector<FlowGraphNode> nodes;
+	vector<NodeId> addressNodes;
+	vector<AddressId> tokenOwners;
+	try
+	{
+		BinaryImporter(data, _snapshot.size()).readMappedFlowGraph(graph, nodes, addressNodes, tokenOwners);
+	}
+	catch (Exception const&)
+	{
+		return false;
+	}
+	return true;
+}
+
+int main()
+{
+	Address users[3] = {
+		Address("0x1000000000000000000000000000000000000001"),
+		Address("0x1000000000000000000000000000000000000002"),
+		Address("0x1000000000000000000000000000000000000003")
+	};
+	Address tokens[3] = {
+		Address("0x2000000000000000000000000000000000000001"),
+		Address("0x2000000000000000000000000000000000000002"),
+		Address("0x2000000000000000000000000000000000000003")
+	};
+	DB db;
+	for (size_t i = 0; i < 3; i++)
+		db.signup(users[i], tokens[i]);
+	for (size_t i = 0; i < 3; i++)
+	{
+		db.transfer(tokens[i], Address{}, users[i], Int(100));
+		db.trust(users[i], users[(i + 1) % 3], 50);
+		db.trust(users[(i + 1) % 3], users[i], 50);
+	}
+	db.computeEdges();
+
+	stringstream stream;
+	BinaryExporter(stream).write(42, db);
+	string snapshot = stream.str();
+	if (!loads(snapshot))
+	{
+		printf("The snapshot does not load.\n");
+		return 1;
+	}
+
+	// Header: magic, version, block number, section count, zero; 24 bytes per section.
+	size_t section = 0;
+	for (uint32_t i = 0; i < readAt<uint32_t>(snapshot, 16); i++)
+		if (readAt<uint32_t>(snapshot, 24 + 24 * i) == uint32_t(SnapshotSection::FlowGraph))
+			section = readAt<uint64_t>(snapshot, 24 + 24 * i + 8);
+	if (section == 0)
+	{
+		printf("The snapshot does not contain the flow graph.\n");
+		return 1;
+	}
+	size_t nodeCount = readAt<uint64_t>(snapshot, section);
+	size_t arcCount = readAt<uint64_t>(snapshot, section + 8);
+	size_t offsets = section + 16 + 32 * arcCount + 8 * nodeCount;
+	size_t targets = offsets + 4 * (nodeCount + 1);
+	size_t reverse = targets + 4 * arcCount;
+
+	// Points the reverse of the first arc to the first arc of a node that
+	// is not its target. Its range still lies within the arcs.
+	NodeId target = readAt<uint32_t>(snapshot, targets);
+	ArcId other = 0;
+	for (NodeId node = 0; node < nodeCount; node++)
+		if (node != target && readAt<uint32_t>(snapshot, offsets + 4 * node) < readAt<uint32_t>(snapshot, offsets + 4 * (node + 1)))
+		{
+			other = readAt<uint32_t>(snapshot, offsets + 4 * node);
+			break;
+		}
+	if (arcCount == 0 || other == readAt<uint32_t>(snapshot, reverse))
+	{
+		printf("The flow graph is too small for the test.\n");
+		return 1;
+	}
+	writeAt<uint32_t>(snapshot, reverse, other);
+
+	// require() reports the rejection on cerr.
+	cerr.setstate(ios::failbit);
+	bool corruptedLoads = loads(snapshot);
+	cerr.clear();
+	if (corruptedLoads)
+	{
+		printf("The snapshot with a reverse arc outside of the arcs of its target loads.\n");
+		return 1;
+	}
+	printf("Snapshots with inconsistent reverse arcs are rejected.\n");
+	return 0;
+}